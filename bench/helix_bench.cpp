@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "generator.hpp"
+#include "output_sink.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+
+// Front end micro benchmarks. Generates synthetic programs of a chosen shape and size and times the
+// tokenizer, the parser and the code generator separately, reporting the best of several runs.
+
+// Every heap allocation made through operator new is counted. Arena blocks come from malloc and are not.
+// The parallel tokenizer allocates on pool threads, hence the atomics.
+static std::atomic<size_t> g_allocations = 0;
+static std::atomic<size_t> g_allocated_bytes = 0;
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+// Kept out of line so GCC doesn't see free() paired with operator new and warn.
+[[gnu::noinline]] void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+// Programs are built from uniquely named lets, since the language has no shadowing. Each generator
+// appends statements until the source reaches `size` bytes.
+class ProgramGenerator {
+public:
+    inline explicit ProgramGenerator(size_t size)
+        : m_size(size)
+    {
+    }
+
+    // Expressions nested `depth` parentheses deep.
+    std::string deep(size_t depth = 48)
+    {
+        begin();
+        while (m_src.size() < m_size) {
+            std::string expr = var(m_count - 1);
+            for (size_t i = 0; i < depth; i++) {
+                const char* op = i % 3 == 0 ? " + " : i % 3 == 1 ? " * " : " - ";
+                expr = "(" + expr + op + std::to_string(i + 1) + ")";
+            }
+            let(expr);
+        }
+        return finish();
+    }
+
+    // A long straight line of lets, each using the previous two.
+    std::string lets()
+    {
+        begin();
+        while (m_src.size() < m_size) {
+            size_t n = m_count;
+            let(var(n - 1) + " + " + std::to_string(n) + " * 3 - " + var(n > 1 ? n - 2 : 0) + " / 2");
+        }
+        return finish();
+    }
+
+    // Groups of `if` scopes nested `depth` deep, each declaring a couple of lets.
+    std::string ifs(size_t depth = 8)
+    {
+        begin();
+        while (m_src.size() < m_size) {
+            size_t outer = m_count - 1;
+            for (size_t i = 0; i < depth; i++) {
+                indent(i);
+                m_src += "if (" + var(m_count - 1) + " > " + std::to_string(i) + ") {\n";
+                indent(i + 1);
+                let(var(m_count - 1) + " - 1");
+                indent(i + 1);
+                let(var(m_count - 1) + " * 2");
+            }
+            for (size_t i = depth; i-- > 0;) {
+                indent(i);
+                m_src += "}\n";
+            }
+            // Names declared inside the scopes are gone again.
+            let(var(outer) + " + 1");
+        }
+        return finish();
+    }
+
+    // Mostly comment lines, with a let after every few.
+    std::string comments(size_t per_let = 4)
+    {
+        begin();
+        while (m_src.size() < m_size) {
+            for (size_t i = 0; i < per_let; i++) {
+                m_src += "// The quick brown fox jumps over the lazy dog; let x = (1 + 2) * 3; exit(0);\n";
+            }
+            let(var(m_count - 1) + " + 1");
+        }
+        return finish();
+    }
+
+private:
+    [[nodiscard]] static std::string var(size_t n)
+    {
+        return "v" + std::to_string(n);
+    }
+
+    void begin()
+    {
+        m_src.clear();
+        m_src.reserve(m_size + 256);
+        m_count = 0;
+        let("7");
+    }
+
+    std::string finish()
+    {
+        m_src += "exit(" + var(m_count - 1) + ");\n";
+        return std::move(m_src);
+    }
+
+    void let(const std::string& expr)
+    {
+        m_src += "let " + var(m_count++) + " = " + expr + ";\n";
+    }
+
+    void indent(size_t level)
+    {
+        m_src.append(level * 4, ' ');
+    }
+
+    size_t m_size;
+    std::string m_src {};
+    size_t m_count = 0;
+};
+
+static size_t count_nodes(const NodeExpr* expr)
+{
+    if (const auto* paren = std::get_if<NodeTermParen>(&expr->var)) {
+        return 1 + count_nodes(paren->expr);
+    }
+    if (const auto* bin = std::get_if<NodeBinExpr>(&expr->var)) {
+        return 1 + count_nodes(bin->lhs) + count_nodes(bin->rhs);
+    }
+    return 1;
+}
+
+static size_t count_nodes(const std::vector<NodeStmt*>& stmts)
+{
+    size_t count = 0;
+    for (const NodeStmt* stmt : stmts) {
+        count += 2;
+        if (const auto* exit_stmt = std::get_if<NodeStmtExit*>(&stmt->var)) {
+            count += count_nodes((*exit_stmt)->expr);
+        }
+        else if (const auto* let = std::get_if<NodeStmtLet*>(&stmt->var)) {
+            count += count_nodes((*let)->expr);
+        }
+        else if (const auto* scope = std::get_if<NodeScope*>(&stmt->var)) {
+            count += count_nodes((*scope)->stmts);
+        }
+        else if (const auto* stmt_if = std::get_if<NodeStmtIf*>(&stmt->var)) {
+            count += 1 + count_nodes((*stmt_if)->expr) + count_nodes((*stmt_if)->scope->stmts);
+        }
+    }
+    return count;
+}
+
+struct Sample {
+    double seconds;
+    size_t allocations;
+    size_t allocated_bytes;
+};
+
+// Runs `fn` `iterations` times and keeps the fastest run. `setup` runs before each timed call, outside
+// the measurement.
+template <typename Setup, typename Fn>
+static Sample measure(size_t iterations, Setup setup, Fn fn)
+{
+    Sample best { .seconds = 1e300, .allocations = 0, .allocated_bytes = 0 };
+    for (size_t i = 0; i < iterations; i++) {
+        setup();
+        size_t allocations = g_allocations;
+        size_t allocated_bytes = g_allocated_bytes;
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best.seconds) {
+            best = { .seconds = seconds,
+                     .allocations = g_allocations - allocations,
+                     .allocated_bytes = g_allocated_bytes - allocated_bytes };
+        }
+    }
+    return best;
+}
+
+static void report(const char* shape, const char* stage, const Sample& sample, size_t bytes, size_t tokens,
+                   size_t nodes)
+{
+    printf("%-9s %-11s %9.2f ms %9.1f MB/s %8.2f Mtok/s ",
+           shape,
+           stage,
+           sample.seconds * 1e3,
+           static_cast<double>(bytes) / sample.seconds / 1e6,
+           static_cast<double>(tokens) / sample.seconds / 1e6);
+    if (nodes > 0) {
+        printf("%8.2f Mnode/s ", static_cast<double>(nodes) / sample.seconds / 1e6);
+    }
+    else {
+        printf("%16s", "");
+    }
+    printf("%10zu allocs %10.1f KB\n", sample.allocations, static_cast<double>(sample.allocated_bytes) / 1024);
+}
+
+static void bench(const char* shape, const std::string& src, size_t iterations, size_t threads, int null_fd)
+{
+    size_t token_count = 0;
+    Sample tokenize = measure(
+        iterations, [] {}, [&] { token_count = Tokenizer(src).tokenize().size(); });
+
+    ThreadPool pool(threads);
+    Sample tokenize_parallel = measure(
+        iterations, [] {}, [&] {
+            if (Tokenizer(src).tokenize_parallel(pool).size() != token_count) {
+                std::cerr << "Parallel tokenize produced a different token count" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        });
+
+    Tokenizer tokenizer(src);
+    std::vector<Token> tokens = tokenizer.tokenize();
+    std::vector<Token> input;
+    std::optional<Parser> parser;
+    std::optional<NodeProgram> tree;
+    size_t node_count = 0;
+    Sample parse = measure(
+        iterations,
+        [&] {
+            input = tokens;
+            parser.reset();
+        },
+        [&] {
+            parser.emplace(tokenizer, std::move(input));
+            tree = parser->parse_program();
+        });
+    node_count = count_nodes(tree.value().statements);
+
+    Sample generate = measure(
+        iterations, [] {}, [&] {
+            OutputSink sink(null_fd);
+            Generator(tree.value()).gen_program(sink);
+        });
+
+    report(shape, "tokenize", tokenize, src.size(), token_count, 0);
+    report(shape, "tokenize-mt", tokenize_parallel, src.size(), token_count, 0);
+    report(shape, "parse", parse, src.size(), token_count, node_count);
+    report(shape, "generate", generate, src.size(), token_count, node_count);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string_view only;
+    size_t size_kb = 1024;
+    size_t iterations = 5;
+    size_t threads = std::thread::hardware_concurrency();
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--shape" && i + 1 < argc) {
+            only = argv[++i];
+        }
+        else if (arg == "--size" && i + 1 < argc) {
+            size_kb = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        }
+        else {
+            std::cerr << "Incorrect Usage. Correct Usage is .." << std::endl;
+            std::cerr << "helix_bench [--shape deep|lets|ifs|comments] [--size <KB>] [--iterations <n>]"
+                      << " [--threads <n>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) {
+        std::cerr << "Unable to open /dev/null" << std::endl;
+        return EXIT_FAILURE;
+    }
+    ProgramGenerator programs(size_kb * 1024);
+    printf("%zu KB per program, best of %zu runs, %zu lexer threads\n", size_kb, iterations, threads);
+    if (only.empty() || only == "deep") {
+        bench("deep", programs.deep(), iterations, threads, null_fd);
+    }
+    if (only.empty() || only == "lets") {
+        bench("lets", programs.lets(), iterations, threads, null_fd);
+    }
+    if (only.empty() || only == "ifs") {
+        bench("ifs", programs.ifs(), iterations, threads, null_fd);
+    }
+    if (only.empty() || only == "comments") {
+        bench("comments", programs.comments(), iterations, threads, null_fd);
+    }
+    close(null_fd);
+    return EXIT_SUCCESS;
+}
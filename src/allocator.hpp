@@ -1,36 +1,184 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator over a list of blocks. A new block is appended whenever the current one is exhausted;
+// blocks are kept across reset() and rewind() so a long running compile loop reuses the same memory.
+// Objects are constructed in place and destructors of non trivially destructible types run on
+// rewind(), reset() and destruction.
 class ArenaAllocator {
 public:
-    inline explicit ArenaAllocator(size_t bytes)
-        : m_size(bytes)
+    struct Marker {
+        size_t block;
+        size_t offset;
+        size_t dtor_count;
+        size_t bytes_used;
+        size_t object_count;
+    };
+
+    inline explicit ArenaAllocator(size_t block_size = 1024 * 64)
+        : m_block_size(std::max(block_size, alignof(std::max_align_t)))
     {
-        m_buffer = static_cast<std::byte*>(malloc(m_size));
-        m_offset = m_buffer;
     }
 
     // CPPCHECK - noCopyConstructor
     inline ArenaAllocator(const ArenaAllocator& other) = delete;
 
     // CPPCHECK - noOperatorEq
-    inline ArenaAllocator operator=(const ArenaAllocator& other) = delete;
+    inline ArenaAllocator& operator=(const ArenaAllocator& other) = delete;
 
     // CPPCHECK - noDestructor
     inline ~ArenaAllocator()
     {
-        free(m_buffer); // Free memory on destruction
+        run_dtors(0);
+        for (const Block& block : m_blocks) {
+            free(block.data); // Free memory on destruction
+        }
+    }
+
+    template <typename T, typename... Args>
+    inline T* alloc(Args&&... args)
+    {
+        void* memory = allocate(sizeof(T), alignof(T));
+        T* object = new (memory) T { std::forward<Args>(args)... };
+        m_object_count++;
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_dtors.push_back({ .destroy = [](void* ptr) { static_cast<T*>(ptr)->~T(); }, .object = object });
+        }
+        return object;
+    }
+
+    inline void* allocate(size_t bytes, size_t align)
+    {
+        if (!m_blocks.empty()) {
+            size_t aligned = align_up(m_blocks[m_block].data, m_offset, align);
+            if (aligned + bytes <= m_blocks[m_block].size) {
+                return bump(aligned, bytes);
+            }
+        }
+        next_block(bytes + align);
+        return bump(align_up(m_blocks[m_block].data, m_offset, align), bytes);
+    }
+
+    [[nodiscard]] inline Marker mark() const
+    {
+        return { .block = m_block,
+                 .offset = m_offset,
+                 .dtor_count = m_dtors.size(),
+                 .bytes_used = m_bytes_used,
+                 .object_count = m_object_count };
     }
 
-    template <typename T>
-    inline T* alloc()
+    // Releases everything allocated after the marker was taken.
+    inline void rewind(const Marker& marker)
     {
-        void* offset = m_offset;
-        m_offset += sizeof(T);
-        return static_cast<T*>(offset);
+        run_dtors(marker.dtor_count);
+        m_block = marker.block;
+        m_offset = marker.offset;
+        m_bytes_used = marker.bytes_used;
+        m_object_count = marker.object_count;
+    }
+
+    inline void reset()
+    {
+        rewind({ .block = 0, .offset = 0, .dtor_count = 0, .bytes_used = 0, .object_count = 0 });
+    }
+
+    [[nodiscard]] inline size_t bytes_used() const
+    {
+        return m_bytes_used;
+    }
+
+    // Objects constructed with alloc() and not yet released.
+    [[nodiscard]] inline size_t object_count() const
+    {
+        return m_object_count;
+    }
+
+    [[nodiscard]] inline size_t high_water() const
+    {
+        return m_high_water;
+    }
+
+    [[nodiscard]] inline size_t bytes_reserved() const
+    {
+        size_t total = 0;
+        for (const Block& block : m_blocks) {
+            total += block.size;
+        }
+        return total;
     }
 
 private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
-};
\ No newline at end of file
+    struct Block {
+        std::byte* data;
+        size_t size;
+    };
+
+    struct Dtor {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    static inline size_t align_up(const std::byte* base, size_t offset, size_t align)
+    {
+        auto address = reinterpret_cast<uintptr_t>(base) + offset;
+        return offset + ((align - address % align) % align);
+    }
+
+    inline void* bump(size_t aligned, size_t bytes)
+    {
+        m_bytes_used += aligned - m_offset + bytes;
+        m_high_water = std::max(m_high_water, m_bytes_used);
+        m_offset = aligned + bytes;
+        return m_blocks[m_block].data + aligned;
+    }
+
+    inline void next_block(size_t min_size)
+    {
+        size_t next = m_blocks.empty() ? 0 : m_block + 1;
+        // Reuse a block kept from before a reset if it is large enough.
+        if (next < m_blocks.size() && m_blocks[next].size >= min_size) {
+            m_block = next;
+            m_offset = 0;
+            return;
+        }
+        size_t grown = m_blocks.empty() ? m_block_size : std::min(m_blocks[m_block].size * 2, s_max_block_size);
+        size_t size = std::max(min_size, grown);
+        auto data = static_cast<std::byte*>(malloc(size));
+        if (data == nullptr) {
+            std::cerr << "Out of memory" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_blocks.insert(m_blocks.begin() + static_cast<std::ptrdiff_t>(next), { .data = data, .size = size });
+        m_block = next;
+        m_offset = 0;
+    }
+
+    inline void run_dtors(size_t keep)
+    {
+        while (m_dtors.size() > keep) {
+            m_dtors.back().destroy(m_dtors.back().object);
+            m_dtors.pop_back();
+        }
+    }
+
+    static constexpr size_t s_max_block_size = 1024 * 1024 * 16;
+
+    size_t m_block_size;
+    std::vector<Block> m_blocks {};
+    size_t m_block = 0;
+    size_t m_offset = 0;
+    std::vector<Dtor> m_dtors {};
+    size_t m_bytes_used = 0;
+    size_t m_high_water = 0;
+    size_t m_object_count = 0;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "compile_error.hpp"
+#include "dead_code.hpp"
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+// Register based bytecode for `helix run`. Every instruction names its operands by register, and the
+// registers of a program form one flat frame: `frame_size` registers for bindings and temporaries,
+// followed by one register per distinct constant, which the VM fills in before it starts. Values have
+// the same semantics as the generated code: wrapping add/sub/mul, unsigned div/mod and signed
+// comparisons producing 0 or 1.
+enum class BytecodeOp : uint8_t {
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    lt,
+    gt,
+    lte,
+    gte,
+    equal,
+    not_equal,
+    // Jump to `dst` unless the comparison of `lhs` and `rhs` holds.
+    jump_unless_lt,
+    jump_unless_gt,
+    jump_unless_lte,
+    jump_unless_gte,
+    jump_unless_equal,
+    jump_unless_not_equal,
+    // Jump to `dst` if `lhs` is zero.
+    jump_if_zero,
+    // End the program with the value of `lhs`.
+    exit,
+};
+
+inline constexpr size_t bytecode_op_count = static_cast<size_t>(BytecodeOp::exit) + 1;
+
+struct BytecodeInstr {
+    BytecodeOp op;
+    // Destination register, or the target instruction of a jump.
+    uint32_t dst = 0;
+    uint32_t lhs = 0;
+    uint32_t rhs = 0;
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeInstr> code;
+    std::vector<uint64_t> constants;
+    uint32_t frame_size;
+};
+
+// Compiles the AST to bytecode. Bindings are immutable, so a `let` of a plain name or literal simply
+// shares the register of its value, and only computed values get registers of their own. Registers are
+// handed out like a stack: temporaries are released once the instruction that consumes them is emitted,
+// and the registers of a scope's bindings once the scope ends.
+class BytecodeCompiler {
+public:
+    inline explicit BytecodeCompiler(const NodeProgram& program)
+        : m_program(program)
+    {
+    }
+
+    [[nodiscard]] BytecodeProgram compile()
+    {
+        compile_stmts(m_program.statements);
+        if (!DeadCodeEliminator::always_exits(m_program.statements)) {
+            emit({ .op = BytecodeOp::exit, .lhs = constant(0) });
+        }
+
+        // Constants go after the frame, which is only known now.
+        for (BytecodeInstr& instr : m_code) {
+            for (uint32_t* reg : { &instr.lhs, &instr.rhs }) {
+                if (*reg & s_constant_flag) {
+                    *reg = m_frame_size + (*reg & ~s_constant_flag);
+                }
+            }
+        }
+        return { .code = std::move(m_code), .constants = std::move(m_constants), .frame_size = m_frame_size };
+    }
+
+private:
+    // Marks operands that refer to constants until the final register numbers are known.
+    static constexpr uint32_t s_constant_flag = 1u << 31;
+
+    static inline BytecodeOp op_of(BinOp op)
+    {
+        switch (op) {
+        case BinOp::add:
+            return BytecodeOp::add;
+        case BinOp::sub:
+            return BytecodeOp::sub;
+        case BinOp::mul:
+            return BytecodeOp::mul;
+        case BinOp::div:
+            return BytecodeOp::div;
+        case BinOp::mod:
+            return BytecodeOp::mod;
+        case BinOp::lt:
+            return BytecodeOp::lt;
+        case BinOp::gt:
+            return BytecodeOp::gt;
+        case BinOp::lte:
+            return BytecodeOp::lte;
+        case BinOp::gte:
+            return BytecodeOp::gte;
+        case BinOp::equal:
+            return BytecodeOp::equal;
+        case BinOp::not_equal:
+            return BytecodeOp::not_equal;
+        }
+        return BytecodeOp::add;
+    }
+
+    // The conditional jump an `if` on a comparison compiles to.
+    [[nodiscard]] static inline BytecodeOp jump_unless_of(BinOp op)
+    {
+        switch (op) {
+        case BinOp::lt:
+            return BytecodeOp::jump_unless_lt;
+        case BinOp::gt:
+            return BytecodeOp::jump_unless_gt;
+        case BinOp::lte:
+            return BytecodeOp::jump_unless_lte;
+        case BinOp::gte:
+            return BytecodeOp::jump_unless_gte;
+        case BinOp::equal:
+            return BytecodeOp::jump_unless_equal;
+        default:
+            assert(op == BinOp::not_equal);
+            return BytecodeOp::jump_unless_not_equal;
+        }
+    }
+
+    void emit(BytecodeInstr instr)
+    {
+        m_code.push_back(instr);
+    }
+
+    uint32_t constant(uint64_t value)
+    {
+        auto [it, inserted] = m_constant_ids.try_emplace(value, static_cast<uint32_t>(m_constants.size()));
+        if (inserted) {
+            m_constants.push_back(value);
+        }
+        return it->second | s_constant_flag;
+    }
+
+    uint32_t allocate()
+    {
+        uint32_t reg = m_next_reg++;
+        m_frame_size = std::max(m_frame_size, m_next_reg);
+        return reg;
+    }
+
+    // Compiles `expr` and returns the register holding its value. A computed value goes into `dst` if
+    // given, otherwise into a fresh temporary.
+    uint32_t compile_expr(const NodeExpr* expr, std::optional<uint32_t> dst = {})
+    {
+        struct ExprVisitor {
+            BytecodeCompiler* compiler;
+            std::optional<uint32_t> dst;
+            uint32_t operator()(const NodeTermIntLit& term_int_lit) const
+            {
+                return compiler->constant(term_int_lit.value);
+            }
+            uint32_t operator()(const NodeTermIdent& term_ident) const
+            {
+                const uint32_t* reg = compiler->m_vars.find(term_ident.name);
+                if (reg == nullptr) {
+                    throw CompileError("Undeclared Identifier: " + std::string(term_ident.name));
+                }
+                return *reg;
+            }
+            uint32_t operator()(const NodeTermParen& term_paren) const
+            {
+                return compiler->compile_expr(term_paren.expr, dst);
+            }
+            uint32_t operator()(const NodeBinExpr& bin_expr) const
+            {
+                uint32_t mark = compiler->m_next_reg;
+                uint32_t lhs = compiler->compile_expr(bin_expr.lhs);
+                uint32_t rhs = compiler->compile_expr(bin_expr.rhs);
+                // Operands are read before the result is written, so it may reuse their registers.
+                compiler->m_next_reg = mark;
+                uint32_t result = dst.has_value() ? dst.value() : compiler->allocate();
+                compiler->emit({ .op = op_of(bin_expr.op), .dst = result, .lhs = lhs, .rhs = rhs });
+                return result;
+            }
+        };
+        return std::visit(ExprVisitor { .compiler = this, .dst = dst }, expr->var);
+    }
+
+    // Emits a jump, to be patched, that is taken when `expr` is false. Comparisons jump on their
+    // operands directly instead of materializing a 0 or 1 first.
+    size_t compile_jump_unless(const NodeExpr* expr)
+    {
+        while (const auto* paren = std::get_if<NodeTermParen>(&expr->var)) {
+            expr = paren->expr;
+        }
+        uint32_t mark = m_next_reg;
+        BytecodeInstr jump { .op = BytecodeOp::jump_if_zero };
+        if (const auto* bin_expr = std::get_if<NodeBinExpr>(&expr->var); bin_expr && is_comparison(bin_expr->op)) {
+            jump.op = jump_unless_of(bin_expr->op);
+            jump.lhs = compile_expr(bin_expr->lhs);
+            jump.rhs = compile_expr(bin_expr->rhs);
+        }
+        else {
+            jump.lhs = compile_expr(expr);
+        }
+        m_next_reg = mark;
+        emit(jump);
+        return m_code.size() - 1;
+    }
+
+    void compile_stmts(const std::vector<NodeStmt*>& stmts)
+    {
+        m_vars.push_scope();
+        uint32_t mark = m_next_reg;
+        for (const NodeStmt* stmt : stmts) {
+            compile_stmt(stmt);
+        }
+        m_next_reg = mark;
+        m_vars.pop_scope();
+    }
+
+    void compile_stmt(const NodeStmt* stmt)
+    {
+        struct StmtVisitor {
+            BytecodeCompiler* compiler;
+            void operator()(const NodeStmtExit* stmt_exit) const
+            {
+                uint32_t mark = compiler->m_next_reg;
+                uint32_t value = compiler->compile_expr(stmt_exit->expr);
+                compiler->m_next_reg = mark;
+                compiler->emit({ .op = BytecodeOp::exit, .lhs = value });
+            }
+            void operator()(const NodeStmtLet* stmt_let) const
+            {
+                if (compiler->m_vars.find(stmt_let->name) != nullptr) {
+                    throw CompileError("Identifier already declared: " + std::string(stmt_let->name));
+                }
+                // Claim the binding's register up front, so the temporaries of the initializer go above it.
+                uint32_t reg = compiler->allocate();
+                uint32_t value = compiler->compile_expr(stmt_let->expr, reg);
+                if (value != reg) {
+                    compiler->m_next_reg--;
+                }
+                compiler->m_vars.declare(stmt_let->name, value);
+            }
+            void operator()(const NodeScope* scope) const
+            {
+                compiler->compile_stmts(scope->stmts);
+            }
+            void operator()(const NodeStmtIf* stmt_if) const
+            {
+                size_t jump = compiler->compile_jump_unless(stmt_if->expr);
+                compiler->compile_stmts(stmt_if->scope->stmts);
+                compiler->m_code[jump].dst = static_cast<uint32_t>(compiler->m_code.size());
+            }
+        };
+        std::visit(StmtVisitor { .compiler = this }, stmt->var);
+    }
+
+    const NodeProgram& m_program;
+    std::vector<BytecodeInstr> m_code {};
+    std::vector<uint64_t> m_constants {};
+    std::unordered_map<uint64_t, uint32_t> m_constant_ids {};
+    SymbolTable<uint32_t> m_vars {};
+    uint32_t m_next_reg = 0;
+    uint32_t m_frame_size = 0;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// On disk cache of compiled executables, keyed by a hash of the source bytes, the output format version and
+// everything else that changes the output. Entries are written under a temporary name and renamed into
+// place, so concurrent compiles, in one batch or in separate processes, never see a partial entry. A hit
+// refreshes the entry's modification time, and once the cache outgrows its size limit the least recently
+// used entries are evicted.
+class CompileCache {
+public:
+    // 128 bit content hash; two independent 64 bit lanes make accidental collisions a non issue.
+    struct Key {
+        uint64_t lo;
+        uint64_t hi;
+
+        [[nodiscard]] inline std::string hex() const
+        {
+            static constexpr std::string_view digits = "0123456789abcdef";
+            std::string text(32, '0');
+            for (size_t i = 0; i < 16; i++) {
+                text[15 - i] = digits[(hi >> (4 * i)) & 0xf];
+                text[31 - i] = digits[(lo >> (4 * i)) & 0xf];
+            }
+            return text;
+        }
+    };
+
+    inline CompileCache(std::filesystem::path dir, uint64_t max_bytes)
+        : m_dir(std::move(dir))
+        , m_max_bytes(max_bytes)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+    }
+
+    // Key for compiling `source` with `config`, which names the target and every option that affects
+    // the output.
+    [[nodiscard]] static inline Key key(std::string_view source, std::string_view config)
+    {
+        Key key = hash(s_format_version, { .lo = 0, .hi = 0 });
+        key = hash(config, key);
+        return hash(source, key);
+    }
+
+    // Copies the executable cached under `key` to `output`. Returns false on a miss.
+    [[nodiscard]] inline bool fetch(const Key& key, const std::string& output)
+    {
+        std::filesystem::path entry = m_dir / key.hex();
+        std::error_code ec;
+        std::filesystem::copy_file(entry, output, std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec) {
+            m_misses++;
+            return false;
+        }
+        std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+        m_hits++;
+        return true;
+    }
+
+    // Adds the executable at `output` under `key`. Failing to cache is not an error; the compile itself
+    // already succeeded.
+    inline void store(const Key& key, const std::string& output)
+    {
+        std::filesystem::path entry = m_dir / key.hex();
+        // Unique per process and thread, so nobody else writes to it.
+        size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+        std::filesystem::path temp
+            = m_dir / (key.hex() + ".tmp" + std::to_string(getpid()) + "." + std::to_string(thread));
+        std::error_code ec;
+        std::filesystem::copy_file(output, temp, std::filesystem::copy_options::overwrite_existing, ec);
+        uint64_t size = std::filesystem::file_size(temp, ec);
+        if (!ec) {
+            std::filesystem::rename(temp, entry, ec);
+        }
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return;
+        }
+
+        std::lock_guard lock(m_mutex);
+        if (m_scanned) {
+            m_size += size;
+        }
+        else {
+            m_size = scan().second;
+            m_scanned = true;
+        }
+        if (m_size > m_max_bytes) {
+            evict();
+        }
+    }
+
+    [[nodiscard]] inline uint64_t hits() const
+    {
+        return m_hits;
+    }
+
+    [[nodiscard]] inline uint64_t misses() const
+    {
+        return m_misses;
+    }
+
+private:
+    // Bump whenever a change to the compiler changes the executables it produces for the same source, so
+    // entries from older compilers are no longer hit.
+    static constexpr std::string_view s_format_version = "helix-cache-1";
+
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type used;
+        uint64_t size;
+    };
+
+    static inline uint64_t mix(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccd;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53;
+        return value ^ (value >> 33);
+    }
+
+    // Eight bytes at a time into two lanes with different multipliers and rotations.
+    static inline Key hash(std::string_view data, Key seed)
+    {
+        uint64_t a = seed.lo ^ 0x9E3779B97F4A7C15;
+        uint64_t b = seed.hi ^ 0xC2B2AE3D27D4EB4F;
+        size_t i = 0;
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, 8);
+            a = std::rotl(a ^ word, 29) * 0x9E3779B97F4A7C15;
+            b = std::rotl(b + word, 31) * 0xC2B2AE3D27D4EB4F;
+        }
+        uint64_t tail = 0;
+        if (i < data.size()) {
+            std::memcpy(&tail, data.data() + i, data.size() - i);
+        }
+        a = std::rotl(a ^ tail, 29) * 0x9E3779B97F4A7C15;
+        b = std::rotl(b + tail, 31) * 0xC2B2AE3D27D4EB4F;
+        return { .lo = mix(a ^ (data.size() << 1)), .hi = mix(b + a) };
+    }
+
+    // Every complete entry in the cache directory and their total size. Other processes may be adding
+    // and removing entries at the same time, so this is only a snapshot.
+    [[nodiscard]] inline std::pair<std::vector<Entry>, uint64_t> scan() const
+    {
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(m_dir, ec)) {
+            std::error_code entry_ec;
+            uint64_t size = file.file_size(entry_ec);
+            auto used = file.last_write_time(entry_ec);
+            if (entry_ec || file.path().filename().string().find(".tmp") != std::string::npos) {
+                continue;
+            }
+            entries.push_back({ .path = file.path(), .used = used, .size = size });
+            total += size;
+        }
+        return { std::move(entries), total };
+    }
+
+    // Deletes least recently used entries until the cache fits its size limit again.
+    inline void evict()
+    {
+        auto [entries, total] = scan();
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        std::error_code ec;
+        for (const Entry& entry : entries) {
+            if (total <= m_max_bytes) {
+                break;
+            }
+            std::filesystem::remove(entry.path, ec);
+            total -= entry.size;
+        }
+        m_size = total;
+    }
+
+    std::filesystem::path m_dir;
+    uint64_t m_max_bytes;
+    // Size of the cache as of the last scan plus everything stored since, guarded by m_mutex.
+    std::mutex m_mutex {};
+    uint64_t m_size = 0;
+    bool m_scanned = false;
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+};
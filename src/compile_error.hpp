@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// An error in the program being compiled, or in reading it. Stages throw it rather than ending the
+// process, so that in a batch one bad input fails on its own while the others finish.
+class CompileError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+// Folds binary expressions over integer literals and propagates the values of constant `let`
+// bindings into the expressions that read them, rewriting folded subtrees into literals in place.
+// Arithmetic follows the generated code: 64 bit wrapping add/sub/mul, unsigned div/mod and signed
+// comparisons producing 0 or 1.
+class ConstantFolder {
+public:
+    void fold_program(NodeProgram& program)
+    {
+        begin_scope();
+        for (NodeStmt* stmt : program.statements) {
+            fold_stmt(stmt);
+        }
+        end_scope();
+    }
+
+private:
+    std::optional<uint64_t> fold_expr(NodeExpr* expr)
+    {
+        struct ExprVisitor {
+            ConstantFolder* folder;
+            std::optional<uint64_t> operator()(NodeTermIntLit& term_int_lit) const
+            {
+                return term_int_lit.value;
+            }
+            std::optional<uint64_t> operator()(NodeTermIdent& term_ident) const
+            {
+                if (const auto* value = folder->m_bindings.find(term_ident.name)) {
+                    return *value;
+                }
+                return {};
+            }
+            std::optional<uint64_t> operator()(NodeTermParen& term_paren) const
+            {
+                return folder->fold_expr(term_paren.expr);
+            }
+            std::optional<uint64_t> operator()(NodeBinExpr& bin_expr) const
+            {
+                // Both sides are always visited so nested subtrees get folded even if the other side is not
+                // constant.
+                auto rhs = folder->fold_expr(bin_expr.rhs);
+                auto lhs = folder->fold_expr(bin_expr.lhs);
+                if (!lhs.has_value() || !rhs.has_value()) {
+                    return {};
+                }
+                return fold(bin_expr.op, lhs.value(), rhs.value());
+            }
+        };
+        auto value = std::visit(ExprVisitor { .folder = this }, expr->var);
+        if (value.has_value()) {
+            expr->var = NodeTermIntLit { .value = value.value() };
+        }
+        return value;
+    }
+
+    [[nodiscard]] static std::optional<uint64_t> fold(BinOp op, uint64_t lhs, uint64_t rhs)
+    {
+        auto signed_lhs = static_cast<int64_t>(lhs);
+        auto signed_rhs = static_cast<int64_t>(rhs);
+        switch (op) {
+        case BinOp::add:
+            return lhs + rhs;
+        case BinOp::sub:
+            return lhs - rhs;
+        case BinOp::mul:
+            return lhs * rhs;
+        case BinOp::div:
+            // Division by zero is left for the program to trap on at runtime.
+            if (rhs == 0) {
+                return {};
+            }
+            return lhs / rhs;
+        case BinOp::mod:
+            if (rhs == 0) {
+                return {};
+            }
+            return lhs % rhs;
+        case BinOp::lt:
+            return signed_lhs < signed_rhs;
+        case BinOp::gt:
+            return signed_lhs > signed_rhs;
+        case BinOp::lte:
+            return signed_lhs <= signed_rhs;
+        case BinOp::gte:
+            return signed_lhs >= signed_rhs;
+        case BinOp::equal:
+            return lhs == rhs;
+        case BinOp::not_equal:
+            return lhs != rhs;
+        }
+        return {};
+    }
+
+    void fold_scope(NodeScope* scope)
+    {
+        begin_scope();
+        for (NodeStmt* stmt : scope->stmts) {
+            fold_stmt(stmt);
+        }
+        end_scope();
+    }
+
+    void fold_stmt(NodeStmt* stmt)
+    {
+        struct StmtVisitor {
+            ConstantFolder* folder;
+            void operator()(NodeStmtExit* stmt_exit) const
+            {
+                folder->fold_expr(stmt_exit->expr);
+            }
+            void operator()(NodeStmtLet* stmt_let) const
+            {
+                auto value = folder->fold_expr(stmt_let->expr);
+                folder->m_bindings.declare(stmt_let->name, value);
+            }
+            void operator()(NodeScope* scope) const
+            {
+                folder->fold_scope(scope);
+            }
+            void operator()(NodeStmtIf* stmt_if) const
+            {
+                folder->fold_expr(stmt_if->expr);
+                folder->fold_scope(stmt_if->scope);
+            }
+        };
+        std::visit(StmtVisitor { .folder = this }, stmt->var);
+    }
+
+    void begin_scope()
+    {
+        m_bindings.push_scope();
+    }
+
+    void end_scope()
+    {
+        m_bindings.pop_scope();
+    }
+
+    SymbolTable<std::optional<uint64_t>> m_bindings {};
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "compile_error.hpp"
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+// Removes statements that can never run: `if` statements whose condition is a literal (after constant
+// folding) are replaced by their scope or dropped, statements following an `exit` in the same scope are
+// dropped, and so are empty scopes. Dropped code is still checked for undeclared and redeclared
+// identifiers, so removing it never hides an error.
+class DeadCodeEliminator {
+public:
+    void eliminate(NodeProgram& program)
+    {
+        eliminate_stmts(program.statements);
+    }
+
+    // True if running `stmts` always ends in an exit, so nothing after them is reachable.
+    [[nodiscard]] static bool always_exits(const std::vector<NodeStmt*>& stmts)
+    {
+        return std::any_of(stmts.begin(), stmts.end(), [](const NodeStmt* stmt) { return exits(stmt); });
+    }
+
+private:
+    [[nodiscard]] static bool exits(const NodeStmt* stmt)
+    {
+        if (std::holds_alternative<NodeStmtExit*>(stmt->var)) {
+            return true;
+        }
+        if (const auto* scope = std::get_if<NodeScope*>(&stmt->var)) {
+            return always_exits((*scope)->stmts);
+        }
+        return false;
+    }
+
+    void eliminate_stmts(std::vector<NodeStmt*>& stmts)
+    {
+        m_names.push_scope();
+        size_t kept = 0;
+        bool exited = false;
+        for (NodeStmt* stmt : stmts) {
+            if (eliminate_stmt(stmt) && !exited) {
+                stmts[kept++] = stmt;
+                exited = exits(stmt);
+            }
+        }
+        stmts.resize(kept);
+        m_names.pop_scope();
+    }
+
+    // Simplifies `stmt` in place and returns whether it should be kept.
+    bool eliminate_stmt(NodeStmt* stmt)
+    {
+        struct StmtVisitor {
+            DeadCodeEliminator* dce;
+            NodeStmt* stmt;
+            bool operator()(NodeStmtExit* stmt_exit) const
+            {
+                dce->check_expr(stmt_exit->expr);
+                return true;
+            }
+            bool operator()(NodeStmtLet* stmt_let) const
+            {
+                if (dce->m_names.find(stmt_let->name) != nullptr) {
+                    throw CompileError("Identifier already declared: " + std::string(stmt_let->name));
+                }
+                dce->check_expr(stmt_let->expr);
+                dce->m_names.declare(stmt_let->name, true);
+                return true;
+            }
+            bool operator()(NodeScope* scope) const
+            {
+                dce->eliminate_stmts(scope->stmts);
+                return !scope->stmts.empty();
+            }
+            bool operator()(NodeStmtIf* stmt_if) const
+            {
+                dce->check_expr(stmt_if->expr);
+                dce->eliminate_stmts(stmt_if->scope->stmts);
+                auto cond = int_lit_value(stmt_if->expr);
+                if (!cond.has_value()) {
+                    return true;
+                }
+                if (cond.value() == 0 || stmt_if->scope->stmts.empty()) {
+                    return false;
+                }
+                stmt->var = stmt_if->scope;
+                return true;
+            }
+        };
+        return std::visit(StmtVisitor { .dce = this, .stmt = stmt }, stmt->var);
+    }
+
+    void check_expr(const NodeExpr* expr)
+    {
+        struct ExprVisitor {
+            DeadCodeEliminator* dce;
+            void operator()(const NodeTermIntLit&) const
+            {
+            }
+            void operator()(const NodeTermIdent& term_ident) const
+            {
+                if (dce->m_names.find(term_ident.name) == nullptr) {
+                    throw CompileError("Undeclared Identifier: " + std::string(term_ident.name));
+                }
+            }
+            void operator()(const NodeTermParen& term_paren) const
+            {
+                dce->check_expr(term_paren.expr);
+            }
+            void operator()(const NodeBinExpr& bin_expr) const
+            {
+                dce->check_expr(bin_expr.lhs);
+                dce->check_expr(bin_expr.rhs);
+            }
+        };
+        std::visit(ExprVisitor { .dce = this }, expr->var);
+    }
+
+    // Only whether a name is visible matters here.
+    SymbolTable<bool> m_names {};
+};
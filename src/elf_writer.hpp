@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+// Builds a static ELF64 executable for x86-64 Linux around position independent machine code.
+// The file is a single read+execute PT_LOAD segment mapping the headers and `.text`; a small section
+// table with `.symtab` is appended so tools like objdump and gdb see `_start`.
+class ElfWriter {
+public:
+    static constexpr uint64_t s_base_address = 0x400000;
+
+    [[nodiscard]] std::vector<uint8_t> build(const std::vector<uint8_t>& code)
+    {
+        m_out.clear();
+        const uint64_t text_offset = s_ehdr_size + s_phdr_size;
+        const uint64_t entry = s_base_address + text_offset;
+
+        // Everything after .text is only read by tools and is not part of the loaded segment.
+        const uint64_t symtab_offset = align(text_offset + code.size(), 8);
+        const uint64_t symtab_size = 2 * s_sym_size;
+        const std::string_view strtab("\0_start\0", 8);
+        const std::string_view shstrtab("\0.text\0.symtab\0.strtab\0.shstrtab\0", 33);
+        const uint64_t strtab_offset = symtab_offset + symtab_size;
+        const uint64_t shstrtab_offset = strtab_offset + strtab.size();
+        const uint64_t shdr_offset = align(shstrtab_offset + shstrtab.size(), 8);
+
+        // ELF header
+        bytes({ 0x7F, 'E', 'L', 'F', 2 /* 64 bit */, 1 /* little endian */, 1 /* version */, 0 /* SysV */ });
+        pad(16);
+        u16(2); // ET_EXEC
+        u16(62); // EM_X86_64
+        u32(1);
+        u64(entry);
+        u64(s_ehdr_size); // e_phoff
+        u64(shdr_offset);
+        u32(0);
+        u16(s_ehdr_size);
+        u16(s_phdr_size);
+        u16(1); // e_phnum
+        u16(s_shdr_size);
+        u16(5); // e_shnum
+        u16(4); // e_shstrndx
+
+        // Program header
+        u32(1); // PT_LOAD
+        u32(5); // PF_R | PF_X
+        u64(0);
+        u64(s_base_address);
+        u64(s_base_address);
+        u64(text_offset + code.size());
+        u64(text_offset + code.size());
+        u64(0x1000);
+
+        m_out.insert(m_out.end(), code.begin(), code.end());
+
+        // .symtab: the null symbol and a global function symbol for the entry point
+        pad(symtab_offset);
+        pad(symtab_offset + s_sym_size);
+        u32(1); // "_start"
+        bytes({ 0x12 /* STB_GLOBAL, STT_FUNC */, 0 });
+        u16(1); // .text
+        u64(entry);
+        u64(code.size());
+
+        m_out.insert(m_out.end(), strtab.begin(), strtab.end());
+        m_out.insert(m_out.end(), shstrtab.begin(), shstrtab.end());
+
+        // Section headers: null, .text, .symtab, .strtab, .shstrtab
+        pad(shdr_offset);
+        pad(shdr_offset + s_shdr_size);
+        section(1, 1 /* SHT_PROGBITS */, 6 /* SHF_ALLOC | SHF_EXECINSTR */, entry, text_offset, code.size(), 0, 0, 16, 0);
+        section(7, 2 /* SHT_SYMTAB */, 0, 0, symtab_offset, symtab_size, 3, 1, 8, s_sym_size);
+        section(15, 3 /* SHT_STRTAB */, 0, 0, strtab_offset, strtab.size(), 0, 0, 1, 0);
+        section(23, 3 /* SHT_STRTAB */, 0, 0, shstrtab_offset, shstrtab.size(), 0, 0, 1, 0);
+        return std::move(m_out);
+    }
+
+    // Writes the executable to `path` with the executable bit set. Returns false on I/O errors.
+    [[nodiscard]] bool write(const std::string& path, const std::vector<uint8_t>& code)
+    {
+        std::vector<uint8_t> image = build(code);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+        if (fd < 0) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < image.size()) {
+            ssize_t n = ::write(fd, image.data() + written, image.size() - written);
+            if (n <= 0) {
+                close(fd);
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return close(fd) == 0;
+    }
+
+private:
+    static constexpr uint16_t s_ehdr_size = 64;
+    static constexpr uint16_t s_phdr_size = 56;
+    static constexpr uint16_t s_shdr_size = 64;
+    static constexpr uint64_t s_sym_size = 24;
+
+    static inline uint64_t align(uint64_t value, uint64_t to)
+    {
+        return (value + to - 1) / to * to;
+    }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        m_out.insert(m_out.end(), values);
+    }
+
+    void le(uint64_t value, int size)
+    {
+        for (int i = 0; i < size; i++) {
+            m_out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void u16(uint64_t value)
+    {
+        le(value, 2);
+    }
+
+    void u32(uint64_t value)
+    {
+        le(value, 4);
+    }
+
+    void u64(uint64_t value)
+    {
+        le(value, 8);
+    }
+
+    // Zero fills up to the absolute file offset `offset`.
+    void pad(uint64_t offset)
+    {
+        m_out.resize(offset, 0);
+    }
+
+    void section(
+        uint32_t name,
+        uint32_t type,
+        uint64_t flags,
+        uint64_t addr,
+        uint64_t offset,
+        uint64_t size,
+        uint32_t link,
+        uint32_t info,
+        uint64_t addralign,
+        uint64_t entsize)
+    {
+        u32(name);
+        u32(type);
+        u64(flags);
+        u64(addr);
+        u64(offset);
+        u64(size);
+        u32(link);
+        u32(info);
+        u64(addralign);
+        u64(entsize);
+    }
+
+    std::vector<uint8_t> m_out {};
+};
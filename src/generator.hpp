@@ -1,10 +1,13 @@
-#include "parser.hpp"
+#pragma once
 
-#if __APPLE__
-#define EXIT_SYS_CODE 0x2000001
-#elif __linux__
-#define EXIT_SYS_CODE 60
-#endif
+#include "compile_error.hpp"
+#include "dead_code.hpp"
+#include "instruction.hpp"
+#include "parser.hpp"
+#include "peephole.hpp"
+#include "register_allocator.hpp"
+#include "strength_reduction.hpp"
+#include "symbol_table.hpp"
 
 class Generator {
 public:
@@ -13,186 +16,153 @@ public:
     {
     }
 
-    void gen_term(const NodeTerm* term)
+    void gen_expr(const NodeExpr* expr)
     {
-        struct TermVisitor {
+        struct ExpressionVisitor {
             Generator* gen;
-            void operator()(const NodeTermIntLit* term_int_lit) const
+            void operator()(const NodeTermIntLit& term_int_lit) const
             {
-                gen->m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen->push("rax");
+                gen->emit(Op::mov, Operand::of(Reg::rax), Operand::imm(static_cast<int64_t>(term_int_lit.value)));
+                gen->push(Operand::of(Reg::rax));
             }
-            void operator()(const NodeTermIdent* term_ident) const
+            void operator()(const NodeTermIdent& term_ident) const
             {
-                auto it = std::find_if(gen->m_vars.cbegin(), gen->m_vars.cend(), [&](const Var& var) {
-                    return var.name == term_ident->ident.value.value();
-                });
-                if (it == gen->m_vars.cend()) {
-                    std::cerr << "Undeclared Identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                const Var* var = gen->m_vars.find(term_ident.name);
+                if (var == nullptr) {
+                    throw CompileError("Undeclared Identifier: " + std::string(term_ident.name));
+                }
+                if (var->reg.has_value()) {
+                    gen->push(Operand::of(var->reg.value()));
+                    return;
                 }
-                    std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen->m_stack_size - (*it).stack_location - 1) * 8 << "]\n";
-                gen->push(offset.str());
+                auto offset = static_cast<int32_t>((gen->m_stack_size - var->stack_location - 1) * 8);
+                gen->push(Operand::mem(Reg::rsp, offset));
             }
-            void operator()(const NodeTermParen* term_paren) const
+            void operator()(const NodeTermParen& term_paren) const
             {
-                gen->gen_expr(term_paren->expr);
+                gen->gen_expr(term_paren.expr);
+            }
+            void operator()(const NodeBinExpr& bin_expr) const
+            {
+                gen->gen_bin_expr(bin_expr);
             }
         };
-        TermVisitor visitor({ .gen = this });
-        std::visit(visitor, term->var);
+        ExpressionVisitor visitor { .gen = this };
+        std::visit(visitor, expr->var);
     }
 
-    void gen_bin_expr(const NodeBinExpr* bin_expr)
+    void gen_bin_expr(const NodeBinExpr& bin_expr)
     {
-        struct BinExprVisitor {
-            Generator* gen;
-
-            void operator()(const NodeBinExprAdd* expr_add) const
-            {
-                gen->gen_expr(expr_add->rhs);
-                gen->gen_expr(expr_add->lhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    add rax, rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const NodeBinExprMul* expr_mul) const
-            {
-                gen->gen_expr(expr_mul->rhs);
-                gen->gen_expr(expr_mul->lhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    mul rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const NodeBinExprSub* expr_sub) const
-            {
-                gen->gen_expr(expr_sub->rhs);
-                gen->gen_expr(expr_sub->lhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    sub rax, rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const NodeBinExprDiv* expr_div) const
-            {
-                gen->gen_expr(expr_div->rhs);
-                gen->gen_expr(expr_div->lhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    div rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const NodeBinExprMod* expr_mod) const
-            {
-                gen->gen_expr(expr_mod->rhs);
-                gen->gen_expr(expr_mod->lhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    div rbx\n";
-                gen->push("rdx");
-            }
-            void operator()(const NodeBinExprGt* expr_gt) const
-            {
-                gen->gen_expr(expr_gt->rhs);
-                gen->gen_expr(expr_gt->lhs);
-                gen->m_output << "; preparing gt\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmovg rcx, rdx\n";
-                gen->push("rcx");
-            }
-            void operator()(const NodeBinExprLt* expr_lt) const
-            {
-                gen->gen_expr(expr_lt->rhs);
-                gen->gen_expr(expr_lt->lhs);
-                gen->m_output << "; preparing lt\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmovl rcx, rdx\n";
-                gen->push("rcx");
-            }
-            void operator()(const NodeBinExprGte* expr_gte) const
-            {
-                gen->gen_expr(expr_gte->rhs);
-                gen->gen_expr(expr_gte->lhs);
-                gen->m_output << "; preparing gte\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmovge rcx, rdx\n";
-                gen->push("rcx");
+        // Multiplication, division and modulo by a constant are strength reduced.
+        if (bin_expr.op == BinOp::mul) {
+            auto rhs = int_lit_value(bin_expr.rhs);
+            auto factor = rhs.has_value() ? rhs : int_lit_value(bin_expr.lhs);
+            if (factor.has_value()) {
+                gen_expr(rhs.has_value() ? bin_expr.lhs : bin_expr.rhs);
+                pop(Reg::rax);
+                emit_mul_by_constant(m_code, factor.value());
+                push(Operand::of(Reg::rax));
+                return;
             }
-            void operator()(const NodeBinExprLte* expr_lte) const
-            {
-                gen->gen_expr(expr_lte->rhs);
-                gen->gen_expr(expr_lte->lhs);
-                gen->m_output << "; preparing lte\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmovle rcx, rdx\n";
-                gen->push("rcx");
-            }
-            void operator()(const NodeBinExprEquality* expr_equality) const
-            {
-                gen->gen_expr(expr_equality->rhs);
-                gen->gen_expr(expr_equality->lhs);
-                gen->m_output << "; preparing equality\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmove rcx, rdx\n";
-                gen->push("rcx");
-            }
-            void operator()(const NodeBinExprNotEquality* expr_not_equality) const
-            {
-                gen->gen_expr(expr_not_equality->rhs);
-                gen->gen_expr(expr_not_equality->lhs);
-                gen->m_output << "; preparing not equality\n";
-                gen->m_output << "    mov rcx, 0\n";
-                gen->m_output << "    mov rdx, 1\n";
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    cmp rax, rbx\n";
-                gen->m_output << "    cmovne rcx, rdx\n";
-                gen->push("rcx");
+        }
+        else if (bin_expr.op == BinOp::div || bin_expr.op == BinOp::mod) {
+            if (auto divisor = int_lit_value(bin_expr.rhs); divisor.has_value() && divisor.value() != 0) {
+                bool remainder = bin_expr.op == BinOp::mod;
+                gen_expr(bin_expr.lhs);
+                pop(Reg::rax);
+                emit_div_by_constant(m_code, divisor.value(), remainder);
+                push(Operand::of(remainder ? Reg::rdx : Reg::rax));
+                return;
             }
-        };
+        }
+
+        gen_expr(bin_expr.rhs);
+        gen_expr(bin_expr.lhs);
+        if (is_comparison(bin_expr.op)) {
+            emit(Op::mov, Operand::of(Reg::rcx), Operand::imm(0));
+            emit(Op::mov, Operand::of(Reg::rdx), Operand::imm(1));
+        }
+        pop(Reg::rax);
+        pop(Reg::rbx);
+        switch (bin_expr.op) {
+        case BinOp::add:
+            emit(Op::add, Operand::of(Reg::rax), Operand::of(Reg::rbx));
+            push(Operand::of(Reg::rax));
+            break;
+        case BinOp::sub:
+            emit(Op::sub, Operand::of(Reg::rax), Operand::of(Reg::rbx));
+            push(Operand::of(Reg::rax));
+            break;
+        case BinOp::mul:
+            emit(Op::mul, Operand::of(Reg::rbx));
+            push(Operand::of(Reg::rax));
+            break;
+        case BinOp::div:
+            emit(Op::mov, Operand::of(Reg::rdx), Operand::imm(0));
+            emit(Op::div, Operand::of(Reg::rbx));
+            push(Operand::of(Reg::rax));
+            break;
+        case BinOp::mod:
+            emit(Op::mov, Operand::of(Reg::rdx), Operand::imm(0));
+            emit(Op::div, Operand::of(Reg::rbx));
+            push(Operand::of(Reg::rdx));
+            break;
+        case BinOp::lt:
+        case BinOp::gt:
+        case BinOp::lte:
+        case BinOp::gte:
+        case BinOp::equal:
+        case BinOp::not_equal:
+            emit(Op::cmp, Operand::of(Reg::rax), Operand::of(Reg::rbx));
+            emit_cmov(cond_of(bin_expr.op), Reg::rcx, Reg::rdx);
+            push(Operand::of(Reg::rcx));
+            break;
+        }
+    }
 
-        BinExprVisitor visitor { .gen = this };
-        std::visit(visitor, bin_expr->var);
+    // The condition flags test for a comparison of lhs against rhs.
+    [[nodiscard]] static Cond cond_of(BinOp op)
+    {
+        switch (op) {
+        case BinOp::lt:
+            return Cond::l;
+        case BinOp::gt:
+            return Cond::g;
+        case BinOp::lte:
+            return Cond::le;
+        case BinOp::gte:
+            return Cond::ge;
+        case BinOp::equal:
+            return Cond::e;
+        case BinOp::not_equal:
+            return Cond::ne;
+        default:
+            assert(false); // Should not be reachable;
+            return Cond::e;
+        }
     }
 
-    void gen_expr(const NodeExpr* expr)
+    // Jumps to `label` unless `expr` is true. A comparison is branched on directly with cmp and the inverse
+    // jcc instead of being materialized as 0 or 1 and tested.
+    void gen_jump_unless(const NodeExpr* expr, uint32_t label)
     {
-        struct ExpressionVisitor {
-            Generator* gen;
-            void operator()(const NodeTerm* term) const
-            {
-                gen->gen_term(term);
-            }
-            void operator()(const NodeBinExpr* bin_expr) const
-            {
-                gen->gen_bin_expr(bin_expr);
-            };
-        };
-        ExpressionVisitor visitor { .gen = this };
-        std::visit(visitor, expr->var);
+        // Parentheses around the condition don't change anything.
+        while (const auto* paren = std::get_if<NodeTermParen>(&expr->var)) {
+            expr = paren->expr;
+        }
+        if (const auto* bin_expr = std::get_if<NodeBinExpr>(&expr->var); bin_expr && is_comparison(bin_expr->op)) {
+            gen_expr(bin_expr->rhs);
+            gen_expr(bin_expr->lhs);
+            pop(Reg::rax);
+            pop(Reg::rbx);
+            emit(Op::cmp, Operand::of(Reg::rax), Operand::of(Reg::rbx));
+            emit_jump(Op::jcc, invert(cond_of(bin_expr->op)), label);
+            return;
+        }
+        gen_expr(expr);
+        pop(Reg::rax);
+        emit(Op::test, Operand::of(Reg::rax), Operand::of(Reg::rax));
+        emit_jump(Op::jcc, Cond::e, label);
     }
 
     void gen_scope(const NodeScope* scope)
@@ -211,21 +181,24 @@ public:
             void operator()(const NodeStmtExit* stmt_exit) const
             {
                 gen->gen_expr(stmt_exit->expr);
-                gen->m_output << "    mov rax, " << EXIT_SYS_CODE << "\n";
-                gen->pop("rdi");
-                gen->m_output << "    syscall\n";
+                gen->emit(Op::mov, Operand::of(Reg::rax), Operand::imm(EXIT_SYS_CODE));
+                gen->pop(Reg::rdi);
+                gen->emit(Op::syscall);
             }
             void operator()(const NodeStmtLet* stmt_let) const
             {
-                auto it = std::find_if(gen->m_vars.cbegin(), gen->m_vars.cend(), [&](const Var& var) {
-                    return var.name == stmt_let->ident.value.value();
-                });
-                if (it != gen->m_vars.cend()) {
-                    std::cerr << "Identifier already declared: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                if (gen->m_vars.find(stmt_let->name) != nullptr) {
+                    throw CompileError("Identifier already declared: " + std::string(stmt_let->name));
+                }
+                std::optional<Reg> reg;
+                if (auto assigned = gen->m_registers.find(stmt_let); assigned != gen->m_registers.end()) {
+                    reg = assigned->second;
                 }
-                gen->m_vars.push_back({ .name = stmt_let->ident.value.value(), .stack_location = gen->m_stack_size });
+                gen->m_vars.declare(stmt_let->name, { .stack_location = gen->m_stack_size, .reg = reg });
                 gen->gen_expr(stmt_let->expr);
+                if (reg.has_value()) {
+                    gen->pop(reg.value());
+                }
             }
             void operator()(const NodeScope* scope) const
             {
@@ -233,13 +206,10 @@ public:
             }
             void operator()(const NodeStmtIf* stmt_if) const
             {
-                gen->gen_expr(stmt_if->expr);
-                gen->pop("rax");
                 auto label = gen->create_label();
-                gen->m_output << "    test rax, rax\n";
-                gen->m_output << "    jz " << label << "\n";
+                gen->gen_jump_unless(stmt_if->expr, label);
                 gen->gen_scope(stmt_if->scope);
-                gen->m_output << label << ":\n";
+                gen->emit_label(label);
             }
         };
 
@@ -247,64 +217,92 @@ public:
         std::visit(visitor, stmt->var);
     }
 
-    [[nodiscard]] std::string gen_program()
+    // Lowers the program to machine instructions, which can be printed as assembly or encoded directly.
+    // The stack based output is cleaned up by the peephole optimizer before it is returned.
+    [[nodiscard]] std::vector<Instr> gen_code()
     {
-        m_output << "global _main\n_main:\n";
+        m_registers = RegisterAllocator(m_program).allocate();
 
         for (const NodeStmt* stmt : m_program.statements) {
             gen_stmt(stmt);
         }
 
-        m_output << "    mov rax, " << EXIT_SYS_CODE << "\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall";
-        return m_output.str();
+        if (!DeadCodeEliminator::always_exits(m_program.statements)) {
+            emit(Op::mov, Operand::of(Reg::rax), Operand::imm(EXIT_SYS_CODE));
+            emit(Op::mov, Operand::of(Reg::rdi), Operand::imm(0));
+            emit(Op::syscall);
+        }
+        return PeepholeOptimizer().optimize(std::move(m_code));
+    }
+
+    // Prints the program as NASM source into `out`.
+    void gen_program(OutputSink& out)
+    {
+        print_asm(out, gen_code(), "_main");
     }
 
-    void push(const std::string& reg)
+    void push(Operand operand)
     {
-        m_output << "    push " << reg << "\n";
+        emit(Op::push, operand);
         m_stack_size++;
     }
 
-    void pop(const std::string& reg)
+    void pop(Reg reg)
     {
-        m_output << "    pop " << reg << "\n";
+        emit(Op::pop, Operand::of(reg));
         m_stack_size--;
     }
 
+    void emit(Op op, Operand dst = {}, Operand src = {})
+    {
+        m_code.push_back({ .op = op, .dst = dst, .src = src });
+    }
+
+    void emit_cmov(Cond cond, Reg dst, Reg src)
+    {
+        m_code.push_back({ .op = Op::cmov, .dst = Operand::of(dst), .src = Operand::of(src), .cond = cond });
+    }
+
+    void emit_jump(Op op, Cond cond, uint32_t label)
+    {
+        m_code.push_back({ .op = op, .cond = cond, .label = label });
+    }
+
+    void emit_label(uint32_t label)
+    {
+        m_code.push_back({ .op = Op::label, .label = label });
+    }
+
     struct Var {
-        std::string name;
         size_t stack_location;
+        std::optional<Reg> reg;
     };
 
 private:
-    std::string create_label()
+    uint32_t create_label()
     {
-        std::stringstream ss;
-        ss << "label" << m_label_count++;
-        return ss.str();
+        return m_label_count++;
     }
 
     void begin_scope()
     {
-        m_scopes.push_back(m_vars.size());
+        m_vars.push_scope();
     }
 
     void end_scope()
     {
-        size_t pop_count = m_vars.size() - m_scopes.back();
-        m_output << "     add rsp, " << pop_count * 8 << "\n";
+        auto scope = m_vars.innermost_scope();
+        size_t pop_count = std::count_if(scope.begin(), scope.end(), [](const SymbolTable<Var>::Entry& entry) {
+            return !entry.value.reg.has_value();
+        });
+        emit(Op::add, Operand::of(Reg::rsp), Operand::imm(static_cast<int64_t>(pop_count * 8)));
         m_stack_size -= pop_count;
-        for (int i = 0; i < pop_count; i++) {
-            m_vars.pop_back();
-        }
-        m_scopes.pop_back();
+        m_vars.pop_scope();
     }
     const NodeProgram m_program;
-    std::stringstream m_output;
+    std::vector<Instr> m_code {};
     size_t m_stack_size = 0;
-    std::vector<Var> m_vars {};
-    std::vector<size_t> m_scopes {};
-    int m_label_count = 0;
+    SymbolTable<Var> m_vars {};
+    std::unordered_map<const NodeStmtLet*, Reg> m_registers {};
+    uint32_t m_label_count = 0;
 };
\ No newline at end of file
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "output_sink.hpp"
+
+#if __APPLE__
+#define EXIT_SYS_CODE 0x2000001
+#elif __linux__
+#define EXIT_SYS_CODE 60
+#endif
+
+// Registers in hardware encoding order.
+enum class Reg : uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15,
+};
+
+// Condition codes in hardware encoding order, as used by jcc and cmovcc.
+enum class Cond : uint8_t {
+    o,
+    no,
+    b,
+    ae,
+    e,
+    ne,
+    be,
+    a,
+    s,
+    ns,
+    p,
+    np,
+    l,
+    ge,
+    le,
+    g,
+};
+
+// The condition that holds exactly when `cond` does not; x86 pairs them by the low bit.
+[[nodiscard]] inline constexpr Cond invert(Cond cond)
+{
+    return static_cast<Cond>(static_cast<uint8_t>(cond) ^ 1);
+}
+
+enum class OperandKind : uint8_t {
+    none,
+    reg,
+    imm,
+    // QWORD [reg + index * scale + value], without the index if scale is 0
+    mem,
+};
+
+struct Operand {
+    OperandKind kind = OperandKind::none;
+    Reg reg = Reg::rax;
+    int64_t value = 0;
+    Reg index = Reg::rax;
+    uint8_t scale = 0;
+
+    static inline Operand of(Reg reg)
+    {
+        return { .kind = OperandKind::reg, .reg = reg };
+    }
+
+    static inline Operand imm(int64_t value)
+    {
+        return { .kind = OperandKind::imm, .value = value };
+    }
+
+    static inline Operand mem(Reg base, int32_t disp)
+    {
+        return { .kind = OperandKind::mem, .reg = base, .value = disp };
+    }
+
+    // `scale` is 1, 2, 4 or 8; rsp cannot be an index.
+    static inline Operand mem(Reg base, Reg index, uint8_t scale, int32_t disp)
+    {
+        return { .kind = OperandKind::mem, .reg = base, .value = disp, .index = index, .scale = scale };
+    }
+
+    [[nodiscard]] inline bool is_reg(Reg r) const
+    {
+        return kind == OperandKind::reg && reg == r;
+    }
+};
+
+enum class Op : uint8_t {
+    mov,
+    push,
+    pop,
+    add,
+    sub,
+    mul,
+    div,
+    cmp,
+    cmov,
+    test,
+    _xor,
+    _and,
+    shl,
+    shr,
+    // Signed multiply keeping the low 64 bits, which are the same as for an unsigned one. With an
+    // immediate source this is the three operand form `imul dst, dst, imm`.
+    imul,
+    lea,
+    jcc,
+    jmp,
+    syscall,
+    label,
+};
+
+// A single machine instruction. Two operand instructions use Intel order, `dst` first. Labels are
+// numbered; jumps and label definitions carry the number in `label`.
+struct Instr {
+    Op op;
+    Operand dst {};
+    Operand src {};
+    Cond cond = Cond::e;
+    uint32_t label = 0;
+};
+
+inline constexpr std::array<std::string_view, 16> reg_names
+    = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15" };
+
+inline constexpr std::array<std::string_view, 16> cond_names
+    = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g" };
+
+// The bracketed address of a memory operand, without a size.
+struct Address {
+    const Operand& operand;
+};
+
+inline OutputSink& operator<<(OutputSink& out, Address address)
+{
+    const Operand& operand = address.operand;
+    out << "[" << reg_names[static_cast<size_t>(operand.reg)];
+    if (operand.scale != 0) {
+        out << " + " << reg_names[static_cast<size_t>(operand.index)] << "*" << operand.scale;
+    }
+    return out << " + " << operand.value << "]";
+}
+
+inline OutputSink& operator<<(OutputSink& out, const Operand& operand)
+{
+    switch (operand.kind) {
+    case OperandKind::reg:
+        return out << reg_names[static_cast<size_t>(operand.reg)];
+    case OperandKind::imm:
+        return out << operand.value;
+    case OperandKind::mem:
+        return out << "QWORD " << Address { operand };
+    case OperandKind::none:
+        break;
+    }
+    return out;
+}
+
+// Renders instructions as NASM source with `entry` as the global entry point.
+inline void print_asm(OutputSink& out, const std::vector<Instr>& code, std::string_view entry)
+{
+    out << "global " << entry << "\n" << entry << ":\n";
+    for (const Instr& instr : code) {
+        switch (instr.op) {
+        case Op::mov:
+            out << "    mov " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::push:
+            out << "    push " << instr.dst << "\n";
+            break;
+        case Op::pop:
+            out << "    pop " << instr.dst << "\n";
+            break;
+        case Op::add:
+            out << "    add " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::sub:
+            out << "    sub " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::mul:
+            out << "    mul " << instr.dst << "\n";
+            break;
+        case Op::div:
+            out << "    div " << instr.dst << "\n";
+            break;
+        case Op::cmp:
+            out << "    cmp " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::cmov:
+            out << "    cmov" << cond_names[static_cast<size_t>(instr.cond)] << " " << instr.dst << ", " << instr.src
+                << "\n";
+            break;
+        case Op::test:
+            out << "    test " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::_xor:
+            out << "    xor " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::_and:
+            out << "    and " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::shl:
+            out << "    shl " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::shr:
+            out << "    shr " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::imul:
+            out << "    imul " << instr.dst << ", " << instr.src << "\n";
+            break;
+        case Op::lea:
+            out << "    lea " << instr.dst << ", " << Address { instr.src } << "\n";
+            break;
+        case Op::jcc:
+            out << "    j" << cond_names[static_cast<size_t>(instr.cond)] << " label" << instr.label << "\n";
+            break;
+        case Op::jmp:
+            out << "    jmp label" << instr.label << "\n";
+            break;
+        case Op::syscall:
+            out << "    syscall\n";
+            break;
+        case Op::label:
+            out << "label" << instr.label << ":\n";
+            break;
+        }
+    }
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "output_sink.hpp"
+
+// Mid-level SSA IR. A program is a single function made of basic blocks; every instruction defines
+// exactly one value, numbered by its index in `IrFunction::values`, and every block ends in a terminator.
+// Values are 64 bit integers with the same semantics as the generated code: wrapping add/sub/mul,
+// unsigned div/mod and signed comparisons producing 0 or 1.
+
+using IrValue = uint32_t;
+using IrBlockId = uint32_t;
+
+inline constexpr uint32_t ir_none = UINT32_MAX;
+
+enum class IrOp : uint8_t {
+    constant,
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    gt,
+    lt,
+    gte,
+    lte,
+    equal,
+    not_equal,
+};
+
+inline constexpr std::array<std::string_view, 12> ir_op_names
+    = { "const", "add", "sub", "mul", "div", "mod", "gt", "lt", "gte", "lte", "eq", "ne" };
+
+struct IrInst {
+    IrOp op;
+    IrValue lhs = ir_none;
+    IrValue rhs = ir_none;
+    uint64_t constant = 0;
+};
+
+enum class IrTermKind : uint8_t {
+    // Only valid while a block is being built.
+    none,
+    jump,
+    // Goes to targets[0] if `value` is non zero and to targets[1] otherwise.
+    branch,
+    // Terminates the process with `value` as the exit code.
+    exit,
+};
+
+struct IrTerminator {
+    IrTermKind kind = IrTermKind::none;
+    IrValue value = ir_none;
+    std::array<IrBlockId, 2> targets { ir_none, ir_none };
+
+    [[nodiscard]] inline std::span<const IrBlockId> successors() const
+    {
+        switch (kind) {
+        case IrTermKind::jump:
+            return { targets.data(), 1 };
+        case IrTermKind::branch:
+            return { targets.data(), 2 };
+        default:
+            return {};
+        }
+    }
+};
+
+struct IrBlock {
+    std::vector<IrValue> insts {};
+    IrTerminator term {};
+};
+
+struct IrFunction {
+    std::vector<IrInst> values {};
+    // blocks[0] is the entry block.
+    std::vector<IrBlock> blocks {};
+
+    inline IrBlockId add_block()
+    {
+        blocks.emplace_back();
+        return static_cast<IrBlockId>(blocks.size() - 1);
+    }
+
+    inline IrValue append(IrBlockId block, IrInst inst)
+    {
+        values.push_back(inst);
+        auto value = static_cast<IrValue>(values.size() - 1);
+        blocks[block].insts.push_back(value);
+        return value;
+    }
+};
+
+[[nodiscard]] inline bool is_binary(IrOp op)
+{
+    return op != IrOp::constant;
+}
+
+[[nodiscard]] inline bool is_comparison(IrOp op)
+{
+    return op >= IrOp::gt && op <= IrOp::not_equal;
+}
+
+[[nodiscard]] inline bool is_commutative(IrOp op)
+{
+    return op == IrOp::add || op == IrOp::mul || op == IrOp::equal || op == IrOp::not_equal;
+}
+
+// Calls `fn` with a reference to every value operand of `inst`, so callers can read or rewrite them.
+// `Inst` is IrInst or const IrInst.
+template <typename Inst, typename Fn>
+inline void for_each_operand(Inst& inst, Fn fn)
+{
+    if (is_binary(inst.op)) {
+        fn(inst.lhs);
+        fn(inst.rhs);
+    }
+}
+
+// Predecessors of every block, in no particular order.
+[[nodiscard]] inline std::vector<std::vector<IrBlockId>> predecessors(const IrFunction& fn)
+{
+    std::vector<std::vector<IrBlockId>> preds(fn.blocks.size());
+    for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+        for (IrBlockId succ : fn.blocks[block].term.successors()) {
+            preds[succ].push_back(block);
+        }
+    }
+    return preds;
+}
+
+// Blocks reachable from the entry in reverse post order. The language has no loops, so this is a
+// topological order of the control flow graph and every block comes after all of its predecessors.
+[[nodiscard]] inline std::vector<IrBlockId> reverse_post_order(const IrFunction& fn)
+{
+    std::vector<IrBlockId> order;
+    std::vector<bool> visited(fn.blocks.size(), false);
+    // Explicit stack of (block, successors left to visit) to avoid recursing on deeply nested ifs.
+    // Successors are visited last to first, which puts the taken side of a branch right after it.
+    std::vector<std::pair<IrBlockId, size_t>> stack { { 0, fn.blocks[0].term.successors().size() } };
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto& [block, left] = stack.back();
+        auto succs = fn.blocks[block].term.successors();
+        if (left > 0) {
+            IrBlockId succ = succs[--left];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack.emplace_back(succ, fn.blocks[succ].term.successors().size());
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Immediate dominator of every reachable block, with the entry block dominating itself and unreachable
+// blocks mapped to ir_none. Uses the iterative algorithm by Cooper, Harvey and Kennedy, which needs a
+// single pass over an acyclic graph.
+[[nodiscard]] inline std::vector<IrBlockId> immediate_dominators(const IrFunction& fn, std::span<const IrBlockId> rpo)
+{
+    std::vector<uint32_t> rpo_index(fn.blocks.size(), ir_none);
+    for (uint32_t i = 0; i < rpo.size(); i++) {
+        rpo_index[rpo[i]] = i;
+    }
+    auto preds = predecessors(fn);
+    std::vector<IrBlockId> idom(fn.blocks.size(), ir_none);
+    idom[0] = 0;
+    for (IrBlockId block : rpo.subspan(1)) {
+        IrBlockId dom = ir_none;
+        for (IrBlockId pred : preds[block]) {
+            if (idom[pred] == ir_none) {
+                continue;
+            }
+            if (dom == ir_none) {
+                dom = pred;
+                continue;
+            }
+            IrBlockId other = pred;
+            while (dom != other) {
+                while (rpo_index[dom] > rpo_index[other]) {
+                    dom = idom[dom];
+                }
+                while (rpo_index[other] > rpo_index[dom]) {
+                    other = idom[other];
+                }
+            }
+        }
+        idom[block] = dom;
+    }
+    return idom;
+}
+
+// Number of uses of every value, counting operands and terminators of all blocks.
+[[nodiscard]] inline std::vector<uint32_t> use_counts(const IrFunction& fn)
+{
+    std::vector<uint32_t> uses(fn.values.size(), 0);
+    for (const IrBlock& block : fn.blocks) {
+        for (IrValue value : block.insts) {
+            for_each_operand(fn.values[value], [&](IrValue operand) { uses[operand]++; });
+        }
+        if (block.term.value != ir_none) {
+            uses[block.term.value]++;
+        }
+    }
+    return uses;
+}
+
+// Checks structural invariants and aborts with a message naming the broken one. Meant to run between
+// passes while they are being developed.
+inline void verify(const IrFunction& fn)
+{
+    auto fail = [](std::string_view what, uint32_t where) {
+        std::cerr << "Invalid IR: " << what << " in block" << where << std::endl;
+        exit(EXIT_FAILURE);
+    };
+    std::vector<IrBlockId> defined_in(fn.values.size(), ir_none);
+    for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+        for (IrValue value : fn.blocks[block].insts) {
+            if (value >= fn.values.size() || defined_in[value] != ir_none) {
+                fail("value defined twice or out of range", block);
+            }
+            defined_in[value] = block;
+        }
+    }
+    for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+        const IrBlock& b = fn.blocks[block];
+        for (IrValue value : b.insts) {
+            const IrInst& inst = fn.values[value];
+            if (is_binary(inst.op) && (defined_in[inst.lhs] == ir_none || defined_in[inst.rhs] == ir_none)) {
+                fail("operand without a definition", block);
+            }
+        }
+        switch (b.term.kind) {
+        case IrTermKind::none:
+            fail("missing terminator", block);
+            break;
+        case IrTermKind::branch:
+        case IrTermKind::exit:
+            if (defined_in[b.term.value] == ir_none) {
+                fail("terminator operand without a definition", block);
+            }
+            break;
+        case IrTermKind::jump:
+            break;
+        }
+        for (IrBlockId succ : b.term.successors()) {
+            if (succ >= fn.blocks.size()) {
+                fail("jump to a missing block", block);
+            }
+        }
+    }
+}
+
+// Renders the function in a readable text form, mostly for --dump-ir.
+inline void print_ir(OutputSink& out, const IrFunction& fn)
+{
+    for (IrBlockId block : reverse_post_order(fn)) {
+        out << "block" << block << ":\n";
+        for (IrValue value : fn.blocks[block].insts) {
+            const IrInst& inst = fn.values[value];
+            out << "    %" << value << " = " << ir_op_names[static_cast<size_t>(inst.op)];
+            if (inst.op == IrOp::constant) {
+                out << " " << inst.constant;
+            }
+            else {
+                out << " %" << inst.lhs << ", %" << inst.rhs;
+            }
+            out << "\n";
+        }
+        const IrTerminator& term = fn.blocks[block].term;
+        switch (term.kind) {
+        case IrTermKind::jump:
+            out << "    jump block" << term.targets[0] << "\n";
+            break;
+        case IrTermKind::branch:
+            out << "    branch %" << term.value << ", block" << term.targets[0] << ", block" << term.targets[1] << "\n";
+            break;
+        case IrTermKind::exit:
+            out << "    exit %" << term.value << "\n";
+            break;
+        case IrTermKind::none:
+            break;
+        }
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <iostream>
+
+#include "compile_error.hpp"
+#include "ir.hpp"
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+// Lowers the AST into SSA form. `let` bindings are immutable, so a binding is simply a name for the value
+// of its initializer and no variable ever needs more than one definition. An `if` splits the current
+// block into the branch, the guarded scope and a join block. Bindings made inside the scope go out of
+// scope before the join and everything visible after it is bound to the same value on both incoming
+// edges, so no join ever needs a phi and the IR has none.
+class IrBuilder {
+public:
+    inline explicit IrBuilder(const NodeProgram& program)
+        : m_program(program)
+    {
+    }
+
+    [[nodiscard]] IrFunction build()
+    {
+        m_current = m_fn.add_block();
+        m_vars.push_scope();
+        for (const NodeStmt* stmt : m_program.statements) {
+            lower_stmt(stmt);
+        }
+        m_vars.pop_scope();
+        // Falling off the end of the program exits with 0.
+        if (m_fn.blocks[m_current].term.kind == IrTermKind::none) {
+            terminate({ .kind = IrTermKind::exit, .value = constant(0) });
+        }
+        return std::move(m_fn);
+    }
+
+private:
+    static inline IrOp op_of(BinOp op)
+    {
+        switch (op) {
+        case BinOp::add:
+            return IrOp::add;
+        case BinOp::sub:
+            return IrOp::sub;
+        case BinOp::mul:
+            return IrOp::mul;
+        case BinOp::div:
+            return IrOp::div;
+        case BinOp::mod:
+            return IrOp::mod;
+        case BinOp::lt:
+            return IrOp::lt;
+        case BinOp::gt:
+            return IrOp::gt;
+        case BinOp::lte:
+            return IrOp::lte;
+        case BinOp::gte:
+            return IrOp::gte;
+        case BinOp::equal:
+            return IrOp::equal;
+        case BinOp::not_equal:
+            return IrOp::not_equal;
+        }
+        return IrOp::add;
+    }
+
+    IrValue constant(uint64_t value)
+    {
+        return m_fn.append(m_current, { .op = IrOp::constant, .constant = value });
+    }
+
+    void terminate(IrTerminator term)
+    {
+        m_fn.blocks[m_current].term = term;
+    }
+
+    IrValue lower_expr(const NodeExpr* expr)
+    {
+        struct ExprVisitor {
+            IrBuilder* builder;
+            IrValue operator()(const NodeTermIntLit& term_int_lit) const
+            {
+                return builder->constant(term_int_lit.value);
+            }
+            IrValue operator()(const NodeTermIdent& term_ident) const
+            {
+                const IrValue* value = builder->m_vars.find(term_ident.name);
+                if (value == nullptr) {
+                    throw CompileError("Undeclared Identifier: " + std::string(term_ident.name));
+                }
+                return *value;
+            }
+            IrValue operator()(const NodeTermParen& term_paren) const
+            {
+                return builder->lower_expr(term_paren.expr);
+            }
+            IrValue operator()(const NodeBinExpr& bin_expr) const
+            {
+                IrValue lhs = builder->lower_expr(bin_expr.lhs);
+                IrValue rhs = builder->lower_expr(bin_expr.rhs);
+                return builder->m_fn.append(builder->m_current, { .op = op_of(bin_expr.op), .lhs = lhs, .rhs = rhs });
+            }
+        };
+        return std::visit(ExprVisitor { .builder = this }, expr->var);
+    }
+
+    void lower_scope(const NodeScope* scope)
+    {
+        m_vars.push_scope();
+        for (const NodeStmt* stmt : scope->stmts) {
+            lower_stmt(stmt);
+        }
+        m_vars.pop_scope();
+    }
+
+    void lower_stmt(const NodeStmt* stmt)
+    {
+        struct StmtVisitor {
+            IrBuilder* builder;
+            void operator()(const NodeStmtExit* stmt_exit) const
+            {
+                IrValue value = builder->lower_expr(stmt_exit->expr);
+                builder->terminate({ .kind = IrTermKind::exit, .value = value });
+                // Whatever follows is unreachable but still has to be checked, so it goes into a block
+                // without predecessors.
+                builder->m_current = builder->m_fn.add_block();
+            }
+            void operator()(const NodeStmtLet* stmt_let) const
+            {
+                if (builder->m_vars.find(stmt_let->name) != nullptr) {
+                    throw CompileError("Identifier already declared: " + std::string(stmt_let->name));
+                }
+                IrValue value = builder->lower_expr(stmt_let->expr);
+                builder->m_vars.declare(stmt_let->name, value);
+            }
+            void operator()(const NodeScope* scope) const
+            {
+                builder->lower_scope(scope);
+            }
+            void operator()(const NodeStmtIf* stmt_if) const
+            {
+                IrValue cond = builder->lower_expr(stmt_if->expr);
+                IrBlockId then_block = builder->m_fn.add_block();
+                IrBlockId join = builder->m_fn.add_block();
+                builder->terminate({ .kind = IrTermKind::branch, .value = cond, .targets = { then_block, join } });
+                builder->m_current = then_block;
+                builder->lower_scope(stmt_if->scope);
+                builder->terminate({ .kind = IrTermKind::jump, .targets = { join, ir_none } });
+                builder->m_current = join;
+            }
+        };
+        std::visit(StmtVisitor { .builder = this }, stmt->var);
+    }
+
+    const NodeProgram& m_program;
+    IrFunction m_fn {};
+    IrBlockId m_current = 0;
+    SymbolTable<IrValue> m_vars {};
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "instruction.hpp"
+#include "ir.hpp"
+#include "peephole.hpp"
+#include "register_allocator.hpp"
+#include "strength_reduction.hpp"
+
+// Lowers SSA IR to machine instructions. Blocks are laid out in reverse post order, which is topological
+// since there are no loops, so the live range of a value is the interval from its definition to its last
+// use in layout order. Values get registers by linear scan over those intervals and spill to stack slots
+// reserved on entry. Constants are never materialized on their own; every use encodes them as an immediate,
+// and multiplication and division by a constant are strength reduced.
+class IrCodegen {
+public:
+    inline explicit IrCodegen(const IrFunction& fn)
+        : m_fn(fn)
+    {
+    }
+
+    [[nodiscard]] std::vector<Instr> gen_code()
+    {
+        m_order = reverse_post_order(m_fn);
+        find_fused_compares();
+        allocate();
+        if (m_slots > 0) {
+            emit(Op::sub, Operand::of(Reg::rsp), Operand::imm(static_cast<int64_t>(m_slots * 8)));
+        }
+        for (size_t i = 0; i < m_order.size(); i++) {
+            IrBlockId block = m_order[i];
+            if (i > 0) {
+                m_code.push_back({ .op = Op::label, .label = block });
+            }
+            for (IrValue value : m_fn.blocks[block].insts) {
+                gen_inst(value);
+            }
+            gen_terminator(block, i + 1 < m_order.size() ? m_order[i + 1] : ir_none);
+        }
+        return PeepholeOptimizer().optimize(std::move(m_code));
+    }
+
+private:
+    struct Interval {
+        IrValue value;
+        size_t start;
+        size_t end;
+    };
+
+    // A comparison that ends its block and is used only by the block's branch is never materialized as 0
+    // or 1; the branch compares and jumps on the flags directly.
+    void find_fused_compares()
+    {
+        auto uses = use_counts(m_fn);
+        m_fused.assign(m_fn.values.size(), false);
+        for (IrBlockId block : m_order) {
+            const IrBlock& b = m_fn.blocks[block];
+            if (b.term.kind != IrTermKind::branch || b.insts.empty() || b.insts.back() != b.term.value) {
+                continue;
+            }
+            m_fused[b.term.value] = is_comparison(m_fn.values[b.term.value].op) && uses[b.term.value] == 1;
+        }
+    }
+
+    // Numbers every instruction and terminator in layout order and assigns each non constant value a
+    // register or a stack slot.
+    void allocate()
+    {
+        std::vector<size_t> block_start(m_fn.blocks.size());
+        std::vector<size_t> block_end(m_fn.blocks.size());
+        size_t point = 0;
+        for (IrBlockId block : m_order) {
+            block_start[block] = point;
+            point += m_fn.blocks[block].insts.size();
+            block_end[block] = point++;
+        }
+
+        std::vector<Interval> intervals;
+        std::vector<size_t> interval_of(m_fn.values.size(), SIZE_MAX);
+        auto use = [&](IrValue value, size_t at) {
+            if (interval_of[value] != SIZE_MAX) {
+                intervals[interval_of[value]].end = std::max(intervals[interval_of[value]].end, at);
+            }
+        };
+        for (IrBlockId block : m_order) {
+            size_t at = block_start[block];
+            for (IrValue value : m_fn.blocks[block].insts) {
+                const IrInst& inst = m_fn.values[value];
+                if (inst.op != IrOp::constant && !m_fused[value]) {
+                    interval_of[value] = intervals.size();
+                    intervals.push_back({ .value = value, .start = at, .end = at });
+                }
+                at++;
+            }
+        }
+        for (IrBlockId block : m_order) {
+            size_t at = block_start[block];
+            for (IrValue value : m_fn.blocks[block].insts) {
+                const IrInst& inst = m_fn.values[value];
+                if (is_binary(inst.op)) {
+                    use(inst.lhs, at);
+                    use(inst.rhs, at);
+                }
+                at++;
+            }
+            if (m_fn.blocks[block].term.value != ir_none) {
+                use(m_fn.blocks[block].term.value, block_end[block]);
+            }
+        }
+
+        // Intervals were created in layout order, so they are already sorted by start.
+        m_locations.assign(m_fn.values.size(), Operand {});
+        std::vector<Reg> free_regs(RegisterAllocator::s_registers.rbegin(), RegisterAllocator::s_registers.rend());
+        std::vector<const Interval*> active;
+        for (const Interval& interval : intervals) {
+            std::erase_if(active, [&](const Interval* other) {
+                if (other->end >= interval.start) {
+                    return false;
+                }
+                free_regs.push_back(m_locations[other->value].reg);
+                return true;
+            });
+            if (!free_regs.empty()) {
+                m_locations[interval.value] = Operand::of(free_regs.back());
+                free_regs.pop_back();
+                active.push_back(&interval);
+                continue;
+            }
+            // Same heuristic as the AST allocator: spill whichever live range reaches the furthest.
+            auto furthest = std::max_element(active.begin(), active.end(), [](const Interval* a, const Interval* b) {
+                return a->end < b->end;
+            });
+            if ((*furthest)->end > interval.end) {
+                m_locations[interval.value] = m_locations[(*furthest)->value];
+                m_locations[(*furthest)->value] = spill_slot();
+                *furthest = &interval;
+            }
+            else {
+                m_locations[interval.value] = spill_slot();
+            }
+        }
+    }
+
+    Operand spill_slot()
+    {
+        return Operand::mem(Reg::rsp, static_cast<int32_t>(m_slots++ * 8));
+    }
+
+    [[nodiscard]] Operand location(IrValue value) const
+    {
+        const IrInst& inst = m_fn.values[value];
+        if (inst.op == IrOp::constant) {
+            return Operand::imm(static_cast<int64_t>(inst.constant));
+        }
+        return m_locations[value];
+    }
+
+    // The value as a source operand of an arithmetic instruction, which takes registers and 32 bit
+    // immediates; anything else goes through `scratch`.
+    Operand source(IrValue value, Reg scratch)
+    {
+        Operand operand = location(value);
+        if (operand.kind == OperandKind::reg
+            || (operand.kind == OperandKind::imm && operand.value >= INT32_MIN && operand.value <= INT32_MAX)) {
+            return operand;
+        }
+        emit(Op::mov, Operand::of(scratch), operand);
+        return Operand::of(scratch);
+    }
+
+    // The value as the operand of mul or div, which takes registers and memory but no immediates.
+    Operand multiplier(IrValue value, Reg scratch)
+    {
+        Operand operand = location(value);
+        if (operand.kind != OperandKind::imm) {
+            return operand;
+        }
+        emit(Op::mov, Operand::of(scratch), operand);
+        return Operand::of(scratch);
+    }
+
+    void load(Reg reg, IrValue value)
+    {
+        emit(Op::mov, Operand::of(reg), location(value));
+    }
+
+    void store(IrValue value, Reg reg)
+    {
+        emit(Op::mov, m_locations[value], Operand::of(reg));
+    }
+
+    static inline Cond cond_of(IrOp op)
+    {
+        switch (op) {
+        case IrOp::gt:
+            return Cond::g;
+        case IrOp::lt:
+            return Cond::l;
+        case IrOp::gte:
+            return Cond::ge;
+        case IrOp::lte:
+            return Cond::le;
+        case IrOp::equal:
+            return Cond::e;
+        default:
+            return Cond::ne;
+        }
+    }
+
+    void gen_inst(IrValue value)
+    {
+        const IrInst& inst = m_fn.values[value];
+        const Operand dst = m_locations[value];
+        switch (inst.op) {
+        case IrOp::constant:
+            break;
+        case IrOp::add:
+        case IrOp::sub: {
+            Op op = inst.op == IrOp::add ? Op::add : Op::sub;
+            // Work in the destination register unless that would clobber the right hand side first.
+            if (dst.kind == OperandKind::reg && !location(inst.rhs).is_reg(dst.reg)) {
+                load(dst.reg, inst.lhs);
+                emit(op, dst, source(inst.rhs, Reg::rbx));
+                break;
+            }
+            load(Reg::rax, inst.lhs);
+            emit(op, Operand::of(Reg::rax), source(inst.rhs, Reg::rbx));
+            store(value, Reg::rax);
+            break;
+        }
+        case IrOp::mul: {
+            const IrInst& lhs = m_fn.values[inst.lhs];
+            const IrInst& rhs = m_fn.values[inst.rhs];
+            if (lhs.op == IrOp::constant || rhs.op == IrOp::constant) {
+                bool rhs_constant = rhs.op == IrOp::constant;
+                load(Reg::rax, rhs_constant ? inst.lhs : inst.rhs);
+                emit_mul_by_constant(m_code, rhs_constant ? rhs.constant : lhs.constant);
+                store(value, Reg::rax);
+                break;
+            }
+            load(Reg::rax, inst.lhs);
+            emit(Op::mul, multiplier(inst.rhs, Reg::rbx));
+            store(value, Reg::rax);
+            break;
+        }
+        case IrOp::div:
+        case IrOp::mod:
+            load(Reg::rax, inst.lhs);
+            if (const IrInst& rhs = m_fn.values[inst.rhs]; rhs.op == IrOp::constant && rhs.constant != 0) {
+                emit_div_by_constant(m_code, rhs.constant, inst.op == IrOp::mod);
+                store(value, inst.op == IrOp::div ? Reg::rax : Reg::rdx);
+                break;
+            }
+            emit(Op::mov, Operand::of(Reg::rdx), Operand::imm(0));
+            emit(Op::div, multiplier(inst.rhs, Reg::rbx));
+            store(value, inst.op == IrOp::div ? Reg::rax : Reg::rdx);
+            break;
+        default:
+            if (m_fused[value]) {
+                break;
+            }
+            emit(Op::mov, Operand::of(Reg::rcx), Operand::imm(0));
+            emit(Op::mov, Operand::of(Reg::rdx), Operand::imm(1));
+            gen_compare(inst);
+            m_code.push_back({ .op = Op::cmov,
+                               .dst = Operand::of(Reg::rcx),
+                               .src = Operand::of(Reg::rdx),
+                               .cond = cond_of(inst.op) });
+            store(value, Reg::rcx);
+            break;
+        }
+    }
+
+    // Sets the flags for the comparison `inst`, leaving rcx and rdx alone.
+    void gen_compare(const IrInst& inst)
+    {
+        Operand lhs = location(inst.lhs);
+        if (lhs.kind != OperandKind::reg) {
+            load(Reg::rax, inst.lhs);
+            lhs = Operand::of(Reg::rax);
+        }
+        emit(Op::cmp, lhs, source(inst.rhs, Reg::rbx));
+    }
+
+    void gen_terminator(IrBlockId block, IrBlockId next)
+    {
+        const IrTerminator& term = m_fn.blocks[block].term;
+        switch (term.kind) {
+        case IrTermKind::jump:
+            if (term.targets[0] != next) {
+                emit_jump(Op::jmp, Cond::e, term.targets[0]);
+            }
+            break;
+        case IrTermKind::branch: {
+            auto [then_block, else_block] = term.targets;
+            Cond taken_if = Cond::ne;
+            if (m_fused[term.value]) {
+                gen_compare(m_fn.values[term.value]);
+                taken_if = cond_of(m_fn.values[term.value].op);
+            }
+            else {
+                Operand cond = location(term.value);
+                if (cond.kind == OperandKind::imm) {
+                    IrBlockId taken = cond.value != 0 ? then_block : else_block;
+                    if (taken != next) {
+                        emit_jump(Op::jmp, Cond::e, taken);
+                    }
+                    break;
+                }
+                if (cond.kind == OperandKind::mem) {
+                    emit(Op::mov, Operand::of(Reg::rax), cond);
+                    cond = Operand::of(Reg::rax);
+                }
+                emit(Op::test, cond, cond);
+            }
+            if (then_block == next) {
+                emit_jump(Op::jcc, invert(taken_if), else_block);
+            }
+            else {
+                emit_jump(Op::jcc, taken_if, then_block);
+                if (else_block != next) {
+                    emit_jump(Op::jmp, Cond::e, else_block);
+                }
+            }
+            break;
+        }
+        case IrTermKind::exit:
+            emit(Op::mov, Operand::of(Reg::rdi), location(term.value));
+            emit(Op::mov, Operand::of(Reg::rax), Operand::imm(EXIT_SYS_CODE));
+            emit(Op::syscall);
+            break;
+        case IrTermKind::none:
+            std::cerr << "Invalid IR: missing terminator in block" << block << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void emit(Op op, Operand dst = {}, Operand src = {})
+    {
+        m_code.push_back({ .op = op, .dst = dst, .src = src });
+    }
+
+    void emit_jump(Op op, Cond cond, IrBlockId target)
+    {
+        m_code.push_back({ .op = op, .cond = cond, .label = target });
+    }
+
+    const IrFunction& m_fn;
+    std::vector<IrBlockId> m_order {};
+    std::vector<Operand> m_locations {};
+    std::vector<bool> m_fused {};
+    size_t m_slots = 0;
+    std::vector<Instr> m_code {};
+};
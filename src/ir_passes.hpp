@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "ir.hpp"
+
+// Replaces every instruction that recomputes a value already available in a dominating block with that
+// value. Constants are numbered like everything else, so duplicate literals collapse as well. Walks the
+// dominator tree with a scoped table: an entry made in a block is visible exactly in the blocks it dominates.
+class GlobalValueNumbering {
+public:
+    bool run(IrFunction& fn)
+    {
+        auto rpo = reverse_post_order(fn);
+        auto idom = immediate_dominators(fn, rpo);
+        std::vector<std::vector<IrBlockId>> children(fn.blocks.size());
+        for (IrBlockId block : rpo) {
+            if (block != 0) {
+                children[idom[block]].push_back(block);
+            }
+        }
+
+        std::vector<IrValue> leader(fn.values.size());
+        for (IrValue value = 0; value < leader.size(); value++) {
+            leader[value] = value;
+        }
+        std::unordered_map<Key, IrValue, KeyHash> table;
+        std::vector<Key> added;
+        bool changed = false;
+
+        struct Frame {
+            IrBlockId block;
+            size_t next_child;
+            size_t mark;
+        };
+        std::vector<Frame> stack;
+        auto enter = [&](IrBlockId block) {
+            stack.push_back({ .block = block, .next_child = 0, .mark = added.size() });
+            std::erase_if(fn.blocks[block].insts, [&](IrValue value) {
+                IrInst& inst = fn.values[value];
+                for_each_operand(inst, [&](IrValue& operand) { operand = leader[operand]; });
+                Key key { .op = inst.op, .lhs = inst.lhs, .rhs = inst.rhs, .constant = inst.constant };
+                if (is_commutative(inst.op) && key.lhs > key.rhs) {
+                    std::swap(key.lhs, key.rhs);
+                }
+                auto [it, inserted] = table.try_emplace(key, value);
+                if (inserted) {
+                    added.push_back(key);
+                    return false;
+                }
+                leader[value] = it->second;
+                changed = true;
+                return true;
+            });
+        };
+        enter(0);
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.next_child < children[frame.block].size()) {
+                enter(children[frame.block][frame.next_child++]);
+                continue;
+            }
+            while (added.size() > frame.mark) {
+                table.erase(added.back());
+                added.pop_back();
+            }
+            stack.pop_back();
+        }
+
+        if (changed) {
+            // Unreachable blocks were not visited, so their operands are rewritten separately.
+            for (IrBlock& block : fn.blocks) {
+                for (IrValue value : block.insts) {
+                    for_each_operand(fn.values[value], [&](IrValue& operand) { operand = leader[operand]; });
+                }
+                if (block.term.value != ir_none) {
+                    block.term.value = leader[block.term.value];
+                }
+            }
+        }
+        return changed;
+    }
+
+private:
+    struct Key {
+        IrOp op;
+        IrValue lhs;
+        IrValue rhs;
+        uint64_t constant;
+
+        bool operator==(const Key& other) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            uint64_t hash = static_cast<uint64_t>(key.op);
+            hash = hash * 0x9E3779B97F4A7C15 + key.lhs;
+            hash = hash * 0x9E3779B97F4A7C15 + key.rhs;
+            hash = hash * 0x9E3779B97F4A7C15 + key.constant;
+            return static_cast<size_t>(hash ^ (hash >> 29));
+        }
+    };
+};
+
+// Removes instructions whose values are never used, along with whatever only they used. Division and
+// modulo by anything but a known non zero constant are kept, since they may trap at runtime.
+class DeadValueElimination {
+public:
+    bool run(IrFunction& fn)
+    {
+        auto uses = use_counts(fn);
+        std::vector<bool> removed(fn.values.size(), false);
+        std::vector<IrValue> worklist;
+        for (const IrBlock& block : fn.blocks) {
+            for (IrValue value : block.insts) {
+                if (uses[value] == 0) {
+                    worklist.push_back(value);
+                }
+            }
+        }
+
+        bool changed = false;
+        while (!worklist.empty()) {
+            IrValue value = worklist.back();
+            worklist.pop_back();
+            if (removed[value] || !is_removable(fn, fn.values[value])) {
+                continue;
+            }
+            removed[value] = true;
+            changed = true;
+            for_each_operand(fn.values[value], [&](IrValue operand) {
+                if (--uses[operand] == 0) {
+                    worklist.push_back(operand);
+                }
+            });
+        }
+
+        if (changed) {
+            for (IrBlock& block : fn.blocks) {
+                std::erase_if(block.insts, [&](IrValue value) { return removed[value]; });
+            }
+        }
+        return changed;
+    }
+
+private:
+    [[nodiscard]] static bool is_removable(const IrFunction& fn, const IrInst& inst)
+    {
+        if (inst.op != IrOp::div && inst.op != IrOp::mod) {
+            return true;
+        }
+        const IrInst& divisor = fn.values[inst.rhs];
+        return divisor.op == IrOp::constant && divisor.constant != 0;
+    }
+};
+
+// Cleans up the control flow graph: branches on constants become jumps, a block that is the only
+// successor of its only predecessor is merged into it, and blocks no longer reachable from the entry
+// are deleted and the rest renumbered.
+class CfgSimplification {
+public:
+    bool run(IrFunction& fn)
+    {
+        bool changed = fold_branches(fn);
+        changed |= remove_unreachable(fn);
+        changed |= merge_blocks(fn);
+        changed |= remove_unreachable(fn);
+        return changed;
+    }
+
+private:
+    static bool fold_branches(IrFunction& fn)
+    {
+        bool changed = false;
+        for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+            IrTerminator& term = fn.blocks[block].term;
+            if (term.kind != IrTermKind::branch || fn.values[term.value].op != IrOp::constant) {
+                continue;
+            }
+            bool taken = fn.values[term.value].constant != 0;
+            term = { .kind = IrTermKind::jump, .targets = { term.targets[taken ? 0 : 1], ir_none } };
+            changed = true;
+        }
+        return changed;
+    }
+
+    static bool merge_blocks(IrFunction& fn)
+    {
+        auto preds = predecessors(fn);
+        bool changed = false;
+        for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+            while (fn.blocks[block].term.kind == IrTermKind::jump) {
+                IrBlockId succ = fn.blocks[block].term.targets[0];
+                if (succ == 0 || succ == block || preds[succ].size() != 1) {
+                    break;
+                }
+                IrBlock merged = std::move(fn.blocks[succ]);
+                fn.blocks[succ] = {};
+                IrBlock& into = fn.blocks[block];
+                into.insts.insert(into.insts.end(), merged.insts.begin(), merged.insts.end());
+                into.term = merged.term;
+                // The successors of the merged block now come from `block`.
+                for (IrBlockId after : into.term.successors()) {
+                    std::replace(preds[after].begin(), preds[after].end(), succ, block);
+                }
+                preds[succ].clear();
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    static bool remove_unreachable(IrFunction& fn)
+    {
+        auto rpo = reverse_post_order(fn);
+        if (rpo.size() == fn.blocks.size()) {
+            return false;
+        }
+        // Keep the remaining blocks in their original order, so the entry block stays block 0.
+        std::vector<IrBlockId> renamed(fn.blocks.size(), ir_none);
+        for (IrBlockId block : rpo) {
+            renamed[block] = block;
+        }
+        IrBlockId next = 0;
+        for (IrBlockId& id : renamed) {
+            if (id != ir_none) {
+                id = next++;
+            }
+        }
+
+        std::vector<IrBlock> blocks(next);
+        for (IrBlockId block = 0; block < fn.blocks.size(); block++) {
+            if (renamed[block] == ir_none) {
+                continue;
+            }
+            IrBlock& kept = blocks[renamed[block]];
+            kept = std::move(fn.blocks[block]);
+            for (IrBlockId& target : kept.term.targets) {
+                target = target == ir_none ? ir_none : renamed[target];
+            }
+        }
+        fn.blocks = std::move(blocks);
+        return true;
+    }
+};
@@ -1,46 +1,366 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
+#include "bytecode.hpp"
+#include "compile_cache.hpp"
+#include "const_fold.hpp"
+#include "dead_code.hpp"
+#include "elf_writer.hpp"
 #include "generator.hpp"
+#include "ir_builder.hpp"
+#include "ir_codegen.hpp"
+#include "ir_passes.hpp"
+#include "pass_manager.hpp"
+#include "source_file.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "vm.hpp"
+#include "x86_encoder.hpp"
 
-int main(int argc, char* argv[])
+struct Options {
+    bool use_ir = false;
+    bool dump_ir = false;
+    bool time_passes = false;
+    bool print_stats = false;
+    bool json = false;
+    // Threads for lexing a large source, used when compiling a single file.
+    size_t lex_threads = 1;
+    // Several compiles share the process, so its peak RSS is reported once for the run, not per file.
+    bool concurrent = false;
+    CompileCache* cache = nullptr;
+};
+
+// Sources smaller than this are lexed while parsing, which beats starting threads.
+static constexpr size_t parallel_lex_min_bytes = 1024 * 1024;
+
+// Reports and diagnostics are a few lines, so their sinks start small rather than at the 256 KB meant
+// for assembly.
+static constexpr size_t message_capacity = 4096;
+
+#if __linux__
+static constexpr std::string_view target = "x86_64-linux-elf";
+#else
+static constexpr std::string_view target = "x86_64-macos-macho";
+#endif
+
+// Serializes whole reports and IR dumps, so concurrent compiles never interleave their output.
+static std::mutex output_mutex;
+
+static void write_out(int fd, const OutputSink& text)
 {
+    std::lock_guard lock(output_mutex);
+    text.write_to(fd);
+}
 
-    if (argc != 2) {
-        std::cerr << "Incorrect Usage. Correct Usage is .." << std::endl;
-        std::cerr << "helix <file.he>" << std::endl;
-        return EXIT_FAILURE;
+static void report(CompileStats& stats, const std::string& path, const std::string& output, const Options& options)
+{
+    if (!options.time_passes && !options.print_stats) {
+        return;
+    }
+    struct stat st { };
+    stats.count("output_bytes", stat(output.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0);
+    if (!options.concurrent) {
+        stats.count("peak_rss_bytes", CompileStats::peak_rss());
+    }
+    OutputSink text(message_capacity);
+    if (options.json) {
+        stats.print_json(text, path, options.time_passes, options.print_stats);
     }
-    std::string contents;
-    {
-        std::fstream input(argv[1], std::ios::in);
-        std::stringstream content_stream;
-        content_stream << input.rdbuf();
-        contents = content_stream.str();
+    else {
+        text << "===== " << path << " =====\n";
+        if (options.time_passes) {
+            stats.print_timings(text);
+        }
+        if (options.print_stats) {
+            stats.print_counters(text);
+        }
     }
-    Tokenizer tokenizer(std::move(contents));
-    auto tokens = tokenizer.tokenize();
+    write_out(STDERR_FILENO, text);
+}
 
-    Parser parser(std::move(tokens));
+// Compiles the program at `path` into the executable `output`. Throws a CompileError if the program is
+// invalid or the output can't be written.
+static void build(const std::string& path, const std::string& output, const Options& options)
+{
+    CompileStats stats;
+    SourceFile source(path);
 
-    auto tree = parser.parse_program();
+    // Dumping IR needs the IR, so it always compiles.
+    std::optional<CompileCache::Key> cache_key;
+    if (options.cache != nullptr && !options.dump_ir) {
+        bool hit = stats.time("cache-lookup", [&] {
+            std::string config = std::string(target) + (options.use_ir ? " ir" : " ast");
+            cache_key = CompileCache::key(source.contents(), config);
+            return options.cache->fetch(cache_key.value(), output);
+        });
+        stats.count("cache_hit", hit ? 1 : 0);
+        if (hit) {
+            report(stats, path, output, options);
+            return;
+        }
+    }
+    Tokenizer tokenizer(source.contents());
+    std::optional<Parser> parser;
+    if (options.lex_threads > 1 && source.contents().size() >= parallel_lex_min_bytes) {
+        auto tokens = stats.time("tokenize", [&] {
+            ThreadPool pool(options.lex_threads);
+            return tokenizer.tokenize_parallel(pool);
+        });
+        parser.emplace(tokenizer, std::move(tokens));
+    }
+    else {
+        parser.emplace(tokenizer);
+    }
+
+    // Unless lexed up front, the parser pulls tokens as it goes, so this includes tokenizing.
+    auto tree = stats.time("parse", [&] { return parser->parse_program(); });
 
     if (!tree.has_value()) {
-        std::cerr << "Invalid Program" << std::endl;
-        exit(EXIT_FAILURE);
+        throw CompileError("Invalid Program");
     }
 
-    Generator generator(tree.value());
-    auto assembly = generator.gen_program();
+    ConstantFolder folder;
+    stats.time("fold", [&] { folder.fold_program(tree.value()); });
+    stats.time("dead-code", [&] { DeadCodeEliminator().eliminate(tree.value()); });
+    stats.count("source_bytes", source.contents().size());
+    stats.count("tokens", parser->token_count());
+    stats.count("ast_nodes", parser->allocator().object_count());
+    stats.count("arena_bytes_used", parser->allocator().bytes_used());
+    stats.count("arena_bytes_reserved", parser->allocator().bytes_reserved());
+
+    std::vector<Instr> code;
+    if (options.use_ir) {
+        IrFunction fn = stats.time("ir-build", [&] { return IrBuilder(tree.value()).build(); });
+        PassManager passes;
+        passes.add<CfgSimplification>("simplify-cfg");
+        passes.add<GlobalValueNumbering>("gvn");
+        passes.add<DeadValueElimination>("dve");
+        passes.run(fn, &stats);
+        if (options.dump_ir) {
+            OutputSink ir;
+            print_ir(ir, fn);
+            write_out(STDOUT_FILENO, ir);
+        }
+        stats.count("ir_values", fn.values.size());
+        stats.count("ir_blocks", fn.blocks.size());
+        code = stats.time("codegen", [&] { return IrCodegen(fn).gen_code(); });
+    }
+    else {
+        code = stats.time("codegen", [&] { return Generator(tree.value()).gen_code(); });
+    }
+    stats.count("instructions", code.size());
 
-    {
-        std::fstream file("out.asm", std::ios::out);
-        file << assembly;
+#if __linux__
+    // Encode and link in process; no assembler, linker or intermediate files involved.
+    auto machine_code = stats.time("encode", [&] { return X86Encoder().encode(code); });
+    if (!stats.time("write", [&] { return ElfWriter().write(output, machine_code); })) {
+        throw CompileError("Unable to write " + output);
     }
+    stats.count("code_bytes", machine_code.size());
+#else
+    bool written = stats.time("emit-asm", [&] {
+        int fd = open((output + ".asm").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        OutputSink assembly(fd);
+        print_asm(assembly, code, "_main");
+        assembly.flush();
+        close(fd);
+        stats.count("asm_bytes", assembly.size());
+        return fd >= 0 && assembly.ok();
+    });
+    if (!written) {
+        throw CompileError("Unable to write " + output + ".asm");
+    }
+
+    stats.time_external("assemble", [&] { system(("nasm -f macho64 " + output + ".asm -o " + output + ".o").c_str()); });
+    stats.time_external("link", [&] {
+        system(("ld -o " + output + " " + output + ".o -arch x86_64 -macosx_version_min 10.13 -L /Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk/usr/lib -lSystem").c_str());
+    });
+#endif
 
-    system("nasm -f macho64 out.asm");
-    system("ld -o out out.o -arch x86_64 -macosx_version_min 10.13 -L /Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk/usr/lib -lSystem");
+    if (cache_key.has_value()) {
+        stats.time("cache-store", [&] { options.cache->store(cache_key.value(), output); });
+    }
+    report(stats, path, output, options);
+}
 
-    return EXIT_SUCCESS;
+// Builds `path` into `output` and returns whether that worked. Errors are reported against the input and
+// fail only this compile, so the rest of a batch carries on.
+static bool compile(const std::string& path, const std::string& output, const Options& options)
+{
+    try {
+        build(path, output, options);
+        return true;
+    }
+    catch (const CompileError& error) {
+        OutputSink text(message_capacity);
+        text << path << ": " << error.what() << "\n";
+        write_out(STDERR_FILENO, text);
+        return false;
+    }
+}
+
+// Runs the program at `path` in the bytecode VM instead of building an executable, and returns the status
+// the executable would have exited with.
+static int run(const std::string& path)
+{
+    SourceFile source(path);
+    Tokenizer tokenizer(source.contents());
+    Parser parser(tokenizer);
+    auto tree = parser.parse_program();
+    if (!tree.has_value()) {
+        throw CompileError("Invalid Program");
+    }
+    ConstantFolder folder;
+    folder.fold_program(tree.value());
+    DeadCodeEliminator().eliminate(tree.value());
+    BytecodeProgram program = BytecodeCompiler(tree.value()).compile();
+    // Only the low byte of the exit value reaches the parent, as with the exit system call.
+    return static_cast<int>(Vm::run(program) & 0xff);
+}
+
+// The executable built from `path` in batch mode: the path without its .he extension, or with .out added.
+static std::string output_path(const std::string& path)
+{
+    if (path.size() > 3 && path.ends_with(".he")) {
+        return path.substr(0, path.size() - 3);
+    }
+    return path + ".out";
+}
+
+int main(int argc, char* argv[])
+{
+    // --ir compiles through the SSA IR instead of straight from the AST, --dump-ir also prints the
+    // optimized IR to stdout. --time-passes and --stats report to stderr, as JSON with --json.
+    // Several inputs, or a --manifest listing one per line, compile in parallel on --jobs threads.
+    // --cache reuses executables built before from the same source and options. `helix run` interprets
+    // the program instead and exits with its exit value.
+    if (argc == 3 && std::string_view(argv[1]) == "run") {
+        try {
+            return run(argv[2]);
+        }
+        catch (const CompileError& error) {
+            std::cerr << argv[2] << ": " << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    Options options;
+    std::vector<std::string> paths;
+    size_t jobs = std::thread::hardware_concurrency();
+    const char* cache_dir = nullptr;
+    uint64_t cache_mb = 512;
+    bool batch = false;
+    bool usage_error = false;
+    for (int i = 1; i < argc && !usage_error; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--ir") {
+            options.use_ir = true;
+        }
+        else if (arg == "--dump-ir") {
+            options.use_ir = true;
+            options.dump_ir = true;
+        }
+        else if (arg == "--time-passes") {
+            options.time_passes = true;
+        }
+        else if (arg == "--stats") {
+            options.print_stats = true;
+        }
+        else if (arg == "--json") {
+            options.json = true;
+        }
+        else if ((arg == "--jobs" || arg == "-j") && i + 1 < argc) {
+            jobs = std::strtoull(argv[++i], nullptr, 10);
+            usage_error = jobs == 0;
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            cache_dir = argv[++i];
+        }
+        else if (arg == "--cache-size" && i + 1 < argc) {
+            cache_mb = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--manifest" && i + 1 < argc) {
+            std::ifstream manifest(argv[++i]);
+            if (!manifest) {
+                std::cerr << "Unable to open " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+            for (std::string line; std::getline(manifest, line);) {
+                if (!line.empty()) {
+                    paths.push_back(line);
+                }
+            }
+            batch = true;
+        }
+        else if (!arg.starts_with("-")) {
+            paths.emplace_back(arg);
+        }
+        else {
+            usage_error = true;
+        }
+    }
+
+    if (usage_error || paths.empty()) {
+        std::cerr << "Incorrect Usage. Correct Usage is .." << std::endl;
+        std::cerr << "helix [--ir] [--dump-ir] [--time-passes] [--stats] [--json] <file.he>" << std::endl;
+        std::cerr << "helix [options] [--jobs <n>] [--manifest <list>] <file.he>..." << std::endl;
+        std::cerr << "options: [--cache <dir>] [--cache-size <MB>]" << std::endl;
+        std::cerr << "helix run <file.he>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::optional<CompileCache> cache;
+    if (cache_dir != nullptr) {
+        cache.emplace(cache_dir, cache_mb * 1024 * 1024);
+        options.cache = &cache.value();
+    }
+
+    std::atomic<bool> failed = false;
+    if (!batch && paths.size() == 1) {
+        // A single input keeps writing to `out`, and its threads go to lexing instead.
+        options.lex_threads = jobs;
+        failed = !compile(paths.front(), "out", options);
+    }
+    else {
+        options.concurrent = true;
+        ThreadPool pool(std::min(jobs, paths.size()));
+        for (const std::string& path : paths) {
+            pool.submit([&] {
+                if (!compile(path, output_path(path), options)) {
+                    failed = true;
+                }
+            });
+        }
+    }
+
+    if (options.concurrent && options.print_stats) {
+        OutputSink text(STDERR_FILENO, message_capacity);
+        if (options.json) {
+            text << "{\"process\": {\"peak_rss_bytes\": " << CompileStats::peak_rss() << "}}\n";
+        }
+        else {
+            text << "===== Process =====\n" << CompileStats::peak_rss() << " bytes peak RSS\n";
+        }
+    }
+    if (cache.has_value() && options.print_stats && paths.size() > 1) {
+        OutputSink text(STDERR_FILENO, message_capacity);
+        if (options.json) {
+            text << "{\"cache\": {\"hits\": " << cache->hits() << ", \"misses\": " << cache->misses() << "}}\n";
+        }
+        else {
+            text << "===== Cache =====\n" << cache->hits() << " hits, " << cache->misses() << " misses\n";
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// Append-only text buffer for emitted assembly. Integers are formatted with std::to_chars, so there is
+// no locale or stream state involved. A sink bound to a file descriptor writes its buffer out in large
+// chunks whenever it fills up; an unbound sink simply grows and keeps everything in memory.
+class OutputSink {
+public:
+    inline explicit OutputSink(size_t capacity = s_default_capacity)
+    {
+        m_buffer.reserve(capacity);
+    }
+
+    inline explicit OutputSink(int fd, size_t capacity = s_default_capacity)
+        : m_fd(fd)
+    {
+        m_buffer.reserve(capacity);
+    }
+
+    // CPPCHECK - noCopyConstructor
+    inline OutputSink(const OutputSink& other) = delete;
+
+    // CPPCHECK - noOperatorEq
+    inline OutputSink& operator=(const OutputSink& other) = delete;
+
+    inline ~OutputSink()
+    {
+        flush();
+    }
+
+    inline OutputSink& operator<<(std::string_view text)
+    {
+        if (m_fd >= 0 && m_buffer.size() + text.size() > m_buffer.capacity()) {
+            flush();
+            if (text.size() > m_buffer.capacity()) {
+                write_all(text.data(), text.size());
+                return *this;
+            }
+        }
+        m_buffer.insert(m_buffer.end(), text.begin(), text.end());
+        return *this;
+    }
+
+    inline OutputSink& operator<<(char c)
+    {
+        return *this << std::string_view(&c, 1);
+    }
+
+    inline OutputSink& operator<<(const char* text)
+    {
+        return *this << std::string_view(text);
+    }
+
+    template <typename Int>
+        requires std::is_integral_v<Int>
+    inline OutputSink& operator<<(Int value)
+    {
+        char digits[24];
+        auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+        return *this << std::string_view(digits, static_cast<size_t>(end - digits));
+    }
+
+    // Writes buffered text to the file descriptor, if the sink has one.
+    inline void flush()
+    {
+        if (m_fd < 0 || m_buffer.empty()) {
+            return;
+        }
+        write_all(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+    // Writes the buffered text to `fd` without consuming it, for sinks that build text in memory.
+    inline bool write_to(int fd) const
+    {
+        return write_fd(fd, m_buffer.data(), m_buffer.size());
+    }
+
+    // Everything written so far; only complete for sinks without a file descriptor.
+    [[nodiscard]] inline std::string_view view() const
+    {
+        return { m_buffer.data(), m_buffer.size() };
+    }
+
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Total number of bytes written to the sink.
+    [[nodiscard]] inline size_t size() const
+    {
+        return m_flushed + m_buffer.size();
+    }
+
+private:
+    static constexpr size_t s_default_capacity = 1024 * 256;
+
+    inline void write_all(const char* data, size_t size)
+    {
+        m_flushed += size;
+        if (!write_fd(m_fd, data, size)) {
+            m_ok = false;
+        }
+    }
+
+    static inline bool write_fd(int fd, const char* data, size_t size)
+    {
+        while (size > 0) {
+            ssize_t n = write(fd, data, size);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int m_fd = -1;
+    std::vector<char> m_buffer {};
+    size_t m_flushed = 0;
+    bool m_ok = true;
+};
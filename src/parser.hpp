@@ -1,106 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <optional>
 #include <utility>
+#include <variant>
+#include <vector>
 
 #include "allocator.hpp"
+#include "compile_error.hpp"
 
 #include "tokenization.hpp"
 
 struct NodeTermIntLit {
-    Token int_lit;
+    uint64_t value;
 };
 
 struct NodeTermIdent {
-    Token ident;
+    // A view into the source.
+    std::string_view name;
 };
 
 struct NodeExpr;
 
-struct NodeBinExprAdd {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprMul {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprDiv {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprSub {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-struct NodeBinExprMod {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprLt {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprGt {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
+enum class BinOp : uint8_t {
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    lt,
+    gt,
+    lte,
+    gte,
+    equal,
+    not_equal,
 };
 
-struct NodeBinExprLte {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprGte {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+[[nodiscard]] inline constexpr bool is_comparison(BinOp op)
+{
+    return op >= BinOp::lt;
+}
+
+// The operator a binary operator token stands for.
+[[nodiscard]] inline constexpr BinOp bin_op_of(TokenType type)
+{
+    switch (type) {
+    case TokenType::plus:
+        return BinOp::add;
+    case TokenType::sub:
+        return BinOp::sub;
+    case TokenType::star:
+        return BinOp::mul;
+    case TokenType::div:
+        return BinOp::div;
+    case TokenType::modulo:
+        return BinOp::mod;
+    case TokenType::lt:
+        return BinOp::lt;
+    case TokenType::gt:
+        return BinOp::gt;
+    case TokenType::lte:
+        return BinOp::lte;
+    case TokenType::gte:
+        return BinOp::gte;
+    case TokenType::equality:
+        return BinOp::equal;
+    case TokenType::not_equality:
+        return BinOp::not_equal;
+    default:
+        assert(false); // Should not be reachable;
+        return BinOp::add;
+    }
+}
 
-struct NodeBinExprEquality {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-struct NodeBinExprNotEquality {
+struct NodeBinExpr {
+    BinOp op;
     NodeExpr* lhs;
     NodeExpr* rhs;
 };
 
-struct NodeBinExpr {
-    std::variant<
-        NodeBinExprAdd*,
-        NodeBinExprMul*,
-        NodeBinExprSub*,
-        NodeBinExprDiv*,
-        NodeBinExprMod*,
-        NodeBinExprLt*,
-        NodeBinExprGt*,
-        NodeBinExprLte*,
-        NodeBinExprGte*,
-        NodeBinExprEquality*,
-        NodeBinExprNotEquality*>
-        var;
-};
-
 struct NodeTermParen {
     NodeExpr* expr;
 };
 
-struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*> var;
-};
-
+// Terms and binary expressions live inline, so every node of an expression tree is a single allocation.
 struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
+    std::variant<NodeTermIntLit, NodeTermIdent, NodeTermParen, NodeBinExpr> var;
 };
 
+// The value of `expr` if it is an integer literal.
+[[nodiscard]] inline std::optional<uint64_t> int_lit_value(const NodeExpr* expr)
+{
+    auto int_lit = std::get_if<NodeTermIntLit>(&expr->var);
+    if (int_lit == nullptr) {
+        return {};
+    }
+    return int_lit->value;
+}
+
 struct NodeStmtExit {
     NodeExpr* expr;
 };
 
 struct NodeStmtLet {
-    Token ident;
+    std::string_view name;
     NodeExpr* expr;
 };
 struct NodeStmt;
@@ -124,40 +129,36 @@ struct NodeProgram {
 
 class Parser {
 public:
-    inline explicit Parser(std::vector<Token> tokens)
+    // Tokens lexed up front by `tokenizer`, which holds their literal values and has to outlive the parser.
+    inline Parser(const Tokenizer& tokenizer, std::vector<Token> tokens)
         : m_tokens(std::move(tokens))
-        , m_allocator(1024 * 1024 * 4)
+        , m_tokenizer(&tokenizer)
+    {
+    }
+
+    // Streaming mode: tokens are pulled from the tokenizer on demand, so only the lookahead window is
+    // ever materialized. The tokenizer has to outlive the parser.
+    inline explicit Parser(Tokenizer& tokenizer)
+        : m_tokenizer(&tokenizer)
+        , m_stream(&tokenizer)
     {
     }
 
-    std::optional<NodeTerm*> parse_term()
+    std::optional<NodeExpr*> parse_term()
     {
         if (auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-            term_int_lit->int_lit = int_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_int_lit;
-            return term;
+            return m_allocator.alloc<NodeExpr>(NodeTermIntLit { .value = m_tokenizer->literal(int_lit.value()) });
         }
         else if (auto ident = try_consume(TokenType::identifier)) {
-            auto term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = ident.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
-            return term;
+            return m_allocator.alloc<NodeExpr>(NodeTermIdent { .name = m_tokenizer->text(ident.value()) });
         }
         else if (auto open_paren = try_consume(TokenType::open_parenthesis)) {
             auto expr = parse_expr();
             if (!expr.has_value()) {
-                std::cerr << "Expected Expression" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Expected Expression");
             }
             try_consume(TokenType::close_parenthesis, "Expected `)`");
-            auto term_paren = m_allocator.alloc<NodeTermParen>();
-            term_paren->expr = expr.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_paren;
-            return term;
+            return m_allocator.alloc<NodeExpr>(NodeTermParen { .expr = expr.value() });
         }
         else {
             return {};
@@ -166,114 +167,27 @@ public:
 
     std::optional<NodeExpr*> parse_expr(int min_prec = 0)
     {
-        std::optional<NodeTerm*> term_lhs = parse_term();
-        if (!term_lhs.has_value()) {
+        std::optional<NodeExpr*> expr_lhs = parse_term();
+        if (!expr_lhs.has_value()) {
             return {};
         }
-        auto expr_lhs = m_allocator.alloc<NodeExpr>();
-        expr_lhs->var = term_lhs.value();
         while (true) {
-            std::optional<Token> curr_token = peek();
-            std::optional<int> prec;
-            if (curr_token.has_value()) {
-                prec = bin_prec(curr_token->type);
-                if (!prec.has_value() || prec < min_prec) {
-                    break;
-                }
+            const Token* curr_token = peek();
+            if (curr_token == nullptr) {
+                break;
             }
-            else {
+            std::optional<int> prec = bin_prec(curr_token->type);
+            if (!prec.has_value() || prec < min_prec) {
                 break;
             }
-            Token op = consume();
+            BinOp op = bin_op_of(consume().type);
             int next_min_prec = prec.value() + 1;
             auto expr_rhs = parse_expr(next_min_prec);
             if (!expr_rhs.has_value()) {
-                std::cerr << "Unable to parse expression" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            auto expr = m_allocator.alloc<NodeBinExpr>();
-            auto expr_lhs2 = m_allocator.alloc<NodeExpr>();
-            if (op.type == TokenType::plus) {
-                auto add = m_allocator.alloc<NodeBinExprAdd>();
-                expr_lhs2->var = expr_lhs->var;
-                add->lhs = expr_lhs2;
-                add->rhs = expr_rhs.value();
-                expr->var = add;
-            }
-            else if (op.type == TokenType::sub) {
-                auto sub = m_allocator.alloc<NodeBinExprSub>();
-                expr_lhs2->var = expr_lhs->var;
-                sub->lhs = expr_lhs2;
-                sub->rhs = expr_rhs.value();
-                expr->var = sub;
-            }
-            else if (op.type == TokenType::div) {
-                auto div = m_allocator.alloc<NodeBinExprDiv>();
-                expr_lhs2->var = expr_lhs->var;
-                div->lhs = expr_lhs2;
-                div->rhs = expr_rhs.value();
-                expr->var = div;
-            }
-            else if (op.type == TokenType::star) {
-                auto mul = m_allocator.alloc<NodeBinExprMul>();
-                expr_lhs2->var = expr_lhs->var;
-                mul->lhs = expr_lhs2;
-                mul->rhs = expr_rhs.value();
-                expr->var = mul;
-            }
-            else if (op.type == TokenType::modulo) {
-                auto mod = m_allocator.alloc<NodeBinExprMod>();
-                expr_lhs2->var = expr_lhs->var;
-                mod->lhs = expr_lhs2;
-                mod->rhs = expr_rhs.value();
-                expr->var = mod;
+                throw CompileError("Unable to parse expression");
             }
-            else if (op.type == TokenType::lt) {
-                auto lt = m_allocator.alloc<NodeBinExprLt>();
-                expr_lhs2->var = expr_lhs->var;
-                lt->lhs = expr_lhs2;
-                lt->rhs = expr_rhs.value();
-                expr->var = lt;
-            }
-            else if (op.type == TokenType::gt) {
-                auto gt = m_allocator.alloc<NodeBinExprGt>();
-                expr_lhs2->var = expr_lhs->var;
-                gt->lhs = expr_lhs2;
-                gt->rhs = expr_rhs.value();
-                expr->var = gt;
-            }
-            else if (op.type == TokenType::gte) {
-                auto gte = m_allocator.alloc<NodeBinExprGte>();
-                expr_lhs2->var = expr_lhs->var;
-                gte->lhs = expr_lhs2;
-                gte->rhs = expr_rhs.value();
-                expr->var = gte;
-            }
-            else if (op.type == TokenType::lte) {
-                auto lte = m_allocator.alloc<NodeBinExprLte>();
-                expr_lhs2->var = expr_lhs->var;
-                lte->lhs = expr_lhs2;
-                lte->rhs = expr_rhs.value();
-                expr->var = lte;
-            }
-            else if (op.type == TokenType::equality) {
-                auto equality = m_allocator.alloc<NodeBinExprEquality>();
-                expr_lhs2->var = expr_lhs->var;
-                equality->lhs = expr_lhs2;
-                equality->rhs = expr_rhs.value();
-                expr->var = equality;
-            }
-            else if (op.type == TokenType::not_equality) {
-                auto not_equality = m_allocator.alloc<NodeBinExprNotEquality>();
-                expr_lhs2->var = expr_lhs->var;
-                not_equality->lhs = expr_lhs2;
-                not_equality->rhs = expr_rhs.value();
-                expr->var = not_equality;
-            }
-            else {
-                assert(false); // Should not be reachable;
-            }
-            expr_lhs->var = expr;
+            expr_lhs = m_allocator.alloc<NodeExpr>(
+                NodeBinExpr { .op = op, .lhs = expr_lhs.value(), .rhs = expr_rhs.value() });
         }
         return expr_lhs;
     }
@@ -293,8 +207,7 @@ public:
 
     std::optional<NodeStmt*> parse_stmt()
     {
-        if (peek().value().type == TokenType::exit && peek(1).has_value()
-            && peek(1).value().type == TokenType::open_parenthesis) {
+        if (peek_is(TokenType::exit) && peek_is(TokenType::open_parenthesis, 1)) {
             consume(); // Consume exit token
             consume(); // Consume open parenthesis token
 
@@ -304,8 +217,7 @@ public:
                 stmt_exit->expr = expr.value();
             }
             else {
-                std::cerr << "Expected `(`" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Expected `(`");
             }
             try_consume(TokenType::close_parenthesis, "Expected `)`");
             try_consume(TokenType::semi, "Expected `;`");
@@ -313,35 +225,30 @@ public:
             node_stmt->var = stmt_exit;
             return node_stmt;
         }
-        else if (
-            peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value()
-            && peek(1).value().type == TokenType::identifier && peek(2).has_value()
-            && peek(2).value().type == TokenType::eq) {
+        else if (peek_is(TokenType::let) && peek_is(TokenType::identifier, 1) && peek_is(TokenType::eq, 2)) {
             consume();
             auto stmt = m_allocator.alloc<NodeStmtLet>();
-            stmt->ident = consume();
+            stmt->name = m_tokenizer->text(consume());
             consume();
             if (auto expr = parse_expr()) {
                 stmt->expr = expr.value();
             }
             else {
-                std::cerr << "Invalid Expression" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Expression");
             }
             try_consume(TokenType::semi, "Expected `;`");
             auto node_stmt = m_allocator.alloc<NodeStmt>();
             node_stmt->var = stmt;
             return node_stmt;
         }
-        else if (peek().has_value() && peek().value().type == TokenType::open_curly) {
+        else if (peek_is(TokenType::open_curly)) {
             if (auto scope = parse_scope()) {
                 auto stmt = m_allocator.alloc<NodeStmt>();
                 stmt->var = scope.value();
                 return stmt;
             }
             else {
-                std::cerr << "Invalid Scope" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Scope");
             }
         }
         else if (auto if_ = try_consume(TokenType::_if)) {
@@ -351,16 +258,14 @@ public:
                 stmt_if->expr = expr.value();
             }
             else {
-                std::cerr << "Invalid Expression" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Expression");
             }
             try_consume(TokenType::close_parenthesis, "Expected `)`");
             if (auto scope = parse_scope()) {
                 stmt_if->scope = scope.value();
             }
             else {
-                std::cerr << "Invalid Scope" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Scope");
             }
             auto stmt = m_allocator.alloc<NodeStmt>();
             stmt->var = stmt_if;
@@ -374,53 +279,116 @@ public:
     std::optional<NodeProgram> parse_program()
     {
         NodeProgram program;
-        while (peek().has_value()) {
+        while (peek() != nullptr) {
             if (auto stm = parse_stmt()) {
                 program.statements.push_back(stm.value());
             }
             else {
-                std::cerr << "Invalid Statement" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Statement");
             }
         }
         return program;
     }
 
+    // Tokens consumed so far.
+    [[nodiscard]] inline size_t token_count() const
+    {
+        return m_token_count;
+    }
+
+    // The arena holding the syntax tree; every node is one object in it.
+    [[nodiscard]] inline const ArenaAllocator& allocator() const
+    {
+        return m_allocator;
+    }
+
 private:
+    // The grammar never looks further ahead than peek(2).
+    static constexpr size_t s_lookahead = 4;
+
     const std::vector<Token> m_tokens;
     size_t m_index = 0;
+    // Resolves identifier text and literal values.
+    const Tokenizer* m_tokenizer;
+    // The tokenizer to pull from in streaming mode, null when the tokens were lexed up front.
+    Tokenizer* m_stream = nullptr;
+    std::array<Token, s_lookahead> m_ring {};
+    size_t m_ring_head = 0;
+    size_t m_ring_count = 0;
+    size_t m_token_count = 0;
     ArenaAllocator m_allocator;
-    [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const
+
+    // The token `offset` places ahead, or null past the end of the input. The pointer stays valid until
+    // the next consume().
+    [[nodiscard]] inline const Token* peek(size_t offset = 0)
     {
-        if (m_index + offset >= m_tokens.size()) {
-            return {};
+        assert(offset < s_lookahead);
+        if (m_stream == nullptr) {
+            if (m_index + offset < m_tokens.size()) {
+                return &m_tokens[m_index + offset];
+            }
+            // Lexing stopped here; if it was at an error, that is what a streaming parser would hit now.
+            m_tokenizer->rethrow_error();
+            return nullptr;
         }
-        else {
-            return m_tokens.at(m_index + offset);
+        if (!fill(offset + 1)) {
+            return nullptr;
         }
+        return &m_ring[(m_ring_head + offset) % s_lookahead];
+    }
+
+    [[nodiscard]] inline bool peek_is(TokenType type, size_t offset = 0)
+    {
+        const Token* token = peek(offset);
+        return token != nullptr && token->type == type;
     }
 
-    inline Token try_consume(TokenType type, const std::string& error_msg)
+    // Pulls tokens until the window holds at least `count`, returns false if the input ends first.
+    inline bool fill(size_t count)
     {
-        if (peek().has_value() && peek().value().type == type) {
+        while (m_ring_count < count) {
+            auto token = m_stream->next();
+            if (!token.has_value()) {
+                return false;
+            }
+            m_ring[(m_ring_head + m_ring_count) % s_lookahead] = token.value();
+            m_ring_count++;
+        }
+        return true;
+    }
+
+    inline Token try_consume(TokenType type, const char* error_msg)
+    {
+        if (peek_is(type)) {
             return consume();
         }
         else {
-            std::cerr << error_msg << std::endl;
-            exit(EXIT_FAILURE);
+            throw CompileError(error_msg);
         }
     }
 
-    inline std::optional<Token> try_consume(TokenType type) {
-        if (peek().has_value() && peek().value().type ==type) {
+    inline std::optional<Token> try_consume(TokenType type)
+    {
+        if (peek_is(type)) {
             return consume();
-        } else {
+        }
+        else {
             return {};
         }
     }
 
     inline Token consume()
     {
-        return m_tokens.at(m_index++);
+        if (peek() == nullptr) {
+            throw CompileError("Unexpected end of input");
+        }
+        m_token_count++;
+        if (m_stream == nullptr) {
+            return m_tokens[m_index++];
+        }
+        Token token = m_ring[m_ring_head];
+        m_ring_head = (m_ring_head + 1) % s_lookahead;
+        m_ring_count--;
+        return token;
     }
 };
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+#include "stats.hpp"
+
+// Runs a pipeline of IR passes. A pass is anything with `bool run(IrFunction&)` returning whether it
+// changed the function; analyses are recomputed by the passes that need them, so there is nothing to
+// invalidate. Since one pass can expose work for an earlier one, the pipeline is repeated until it
+// reaches a fixed point or the round limit.
+class PassManager {
+public:
+    template <typename Pass, typename... Args>
+    void add(std::string_view name, Args&&... args)
+    {
+        m_passes.push_back({ .name = name,
+                             .run = [pass = Pass(std::forward<Args>(args)...)](IrFunction& fn) mutable {
+                                 return pass.run(fn);
+                             } });
+    }
+
+    // Returns true if any pass changed the function. With `stats`, each pass is timed as a phase named
+    // after it.
+    bool run(IrFunction& fn, CompileStats* stats = nullptr)
+    {
+#ifndef NDEBUG
+        verify(fn);
+#endif
+        bool changed_any = false;
+        for (size_t round = 0; round < s_max_rounds; round++) {
+            bool changed = false;
+            for (Entry& pass : m_passes) {
+                changed |= stats != nullptr ? stats->time(pass.name, [&] { return pass.run(fn); }) : pass.run(fn);
+#ifndef NDEBUG
+                verify(fn);
+#endif
+            }
+            changed_any |= changed;
+            if (!changed) {
+                break;
+            }
+        }
+        return changed_any;
+    }
+
+private:
+    static constexpr size_t s_max_rounds = 8;
+
+    struct Entry {
+        std::string_view name;
+        std::function<bool(IrFunction&)> run;
+    };
+
+    std::vector<Entry> m_passes {};
+};
@@ -0,0 +1,538 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "instruction.hpp"
+
+// Local cleanups over generated instructions. The generator goes through the stack for every
+// intermediate value, so most of the work is turning push/pop pairs into register moves and then
+// forwarding and dropping the moves that makes redundant. Everything stays within straight line code:
+// labels and jumps end the window. The generator only uses rax, rbx, rcx, rdx and rdi as scratch within a
+// statement, so those and the flags are dead at a label or jump; anything else may be live past it.
+class PeepholeOptimizer {
+public:
+    [[nodiscard]] std::vector<Instr> optimize(std::vector<Instr> code)
+    {
+        // Each round looks at every instruction once, and after a change only revisits its neighbourhood
+        // until that settles, so a nest of push/pop pairs unwinds within one round. Pairs are fused before
+        // anything else is rewritten, since forwarding a copy into the code between a push and its pop can
+        // leave them unfusable. A change can still unblock a rule further away than the neighbourhood, so
+        // rounds repeat while anything changed, up to a bound.
+        m_effects.resize(code.size());
+        for (size_t i = 0; i < code.size(); i++) {
+            m_effects[i] = effects(code[i]);
+        }
+        remove_unreachable(code);
+        for (size_t round = 0; round < s_max_rounds; round++) {
+            m_changed = false;
+            for (size_t i = 0; i < code.size(); i++) {
+                if (code[i].op == Op::pop && !m_removed[i]) {
+                    fuse_push_pop(code, i);
+                }
+            }
+            for (size_t i = code.size(); i-- > 0;) {
+                enqueue(i);
+            }
+            settle(code);
+            compact(code);
+            if (!remove_unreachable(code) && !m_changed) {
+                break;
+            }
+        }
+        use_zero_idioms(code);
+        return code;
+    }
+
+private:
+    // How far the rules look ahead or back before giving up and assuming the worst.
+    static constexpr size_t s_window = 64;
+    // How many neighbours on each side of a change are looked at again.
+    static constexpr size_t s_reach = 2;
+    static constexpr size_t s_max_rounds = 4;
+    static constexpr size_t s_none = SIZE_MAX;
+
+    // Register masks have one bit per register in encoding order, plus one for the flags.
+    static constexpr uint32_t s_flags = 1u << 16;
+    static constexpr uint32_t s_scratch
+        = (1u << static_cast<uint32_t>(Reg::rax)) | (1u << static_cast<uint32_t>(Reg::rbx))
+        | (1u << static_cast<uint32_t>(Reg::rcx)) | (1u << static_cast<uint32_t>(Reg::rdx))
+        | (1u << static_cast<uint32_t>(Reg::rdi)) | s_flags;
+
+    struct Effects {
+        uint32_t uses = 0;
+        uint32_t defs = 0;
+        // Labels and jumps: control can arrive or leave here, so nothing is known past this point.
+        bool barrier = false;
+    };
+
+    static inline uint32_t bit(Reg reg)
+    {
+        return 1u << static_cast<uint32_t>(reg);
+    }
+
+    // Registers read to evaluate the operand, which for memory operands is the base register.
+    static inline uint32_t regs(const Operand& operand)
+    {
+        if (operand.kind == OperandKind::mem && operand.scale != 0) {
+            return bit(operand.reg) | bit(operand.index);
+        }
+        return operand.kind == OperandKind::reg || operand.kind == OperandKind::mem ? bit(operand.reg) : 0;
+    }
+
+    static inline uint32_t written(const Operand& operand)
+    {
+        return operand.kind == OperandKind::reg ? bit(operand.reg) : 0;
+    }
+
+    static inline bool is_zero_idiom(const Instr& instr)
+    {
+        return instr.op == Op::_xor && instr.dst.kind == OperandKind::reg && instr.src.is_reg(instr.dst.reg);
+    }
+
+    static inline bool fits_imm32(const Operand& operand)
+    {
+        return operand.kind == OperandKind::imm && operand.value >= INT32_MIN && operand.value <= INT32_MAX;
+    }
+
+    static Effects effects(const Instr& instr)
+    {
+        const uint32_t rsp = bit(Reg::rsp);
+        switch (instr.op) {
+        case Op::mov:
+            return { .uses = regs(instr.src) | (instr.dst.kind == OperandKind::mem ? regs(instr.dst) : 0),
+                     .defs = written(instr.dst) };
+        case Op::push:
+            return { .uses = regs(instr.dst) | rsp, .defs = rsp };
+        case Op::pop:
+            return { .uses = rsp, .defs = written(instr.dst) | rsp };
+        case Op::add:
+        case Op::sub:
+        case Op::_xor:
+        case Op::_and:
+        case Op::shl:
+        case Op::shr:
+        case Op::imul:
+            return { .uses = is_zero_idiom(instr) ? 0 : regs(instr.dst) | regs(instr.src),
+                     .defs = written(instr.dst) | s_flags };
+        case Op::lea:
+            return { .uses = regs(instr.src), .defs = written(instr.dst) };
+        case Op::cmp:
+        case Op::test:
+            return { .uses = regs(instr.dst) | regs(instr.src), .defs = s_flags };
+        case Op::mul:
+            return { .uses = bit(Reg::rax) | regs(instr.dst), .defs = bit(Reg::rax) | bit(Reg::rdx) | s_flags };
+        case Op::div:
+            return { .uses = bit(Reg::rax) | bit(Reg::rdx) | regs(instr.dst),
+                     .defs = bit(Reg::rax) | bit(Reg::rdx) | s_flags };
+        case Op::cmov:
+            return { .uses = regs(instr.dst) | regs(instr.src) | s_flags, .defs = written(instr.dst) };
+        case Op::syscall:
+            // Number and arguments per the Linux and macOS calling convention; the kernel clobbers rcx and
+            // r11 and returns in rax.
+            return { .uses = bit(Reg::rax) | bit(Reg::rdi) | bit(Reg::rsi) | bit(Reg::rdx) | bit(Reg::r10)
+                         | bit(Reg::r8) | bit(Reg::r9),
+                     .defs = bit(Reg::rax) | bit(Reg::rcx) | bit(Reg::r11) };
+        case Op::jcc:
+            return { .uses = s_flags, .barrier = true };
+        case Op::jmp:
+        case Op::label:
+            return { .barrier = true };
+        }
+        return { .barrier = true };
+    }
+
+    // Instructions whose only effect is writing their defs. div is left out because it can fault.
+    static inline bool is_pure(const Instr& instr)
+    {
+        switch (instr.op) {
+        case Op::mov:
+        case Op::add:
+        case Op::sub:
+        case Op::_xor:
+        case Op::_and:
+        case Op::shl:
+        case Op::shr:
+        case Op::imul:
+        case Op::lea:
+        case Op::cmov:
+            return instr.dst.kind == OperandKind::reg && instr.dst.reg != Reg::rsp;
+        case Op::cmp:
+        case Op::test:
+        case Op::mul:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // True if nothing in `mask` is read by the instructions after `at` before being overwritten.
+    [[nodiscard]] bool is_dead(size_t at, uint32_t mask) const
+    {
+        size_t seen = 0;
+        for (size_t i = m_next[at]; i != s_none; i = m_next[i]) {
+            Effects e = m_effects[i];
+            if ((e.uses & mask) != 0 || ++seen > s_window) {
+                return false;
+            }
+            if (e.barrier) {
+                return (mask & ~s_scratch) == 0;
+            }
+            mask &= ~e.defs;
+            if (mask == 0) {
+                return true;
+            }
+        }
+        return true;
+    }
+
+    // Threads the live instructions into a list in code order, with nothing removed or queued yet.
+    void link(const std::vector<Instr>& code)
+    {
+        size_t n = code.size();
+        m_prev.resize(n);
+        m_next.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            m_prev[i] = i > 0 ? i - 1 : s_none;
+            m_next[i] = i + 1 < n ? i + 1 : s_none;
+        }
+        m_removed.assign(n, 0);
+        m_queued.assign(n, 0);
+    }
+
+    // Unlinks an instruction. Its own links are left alone, so walking from it still reaches its
+    // neighbours.
+    void remove(size_t at)
+    {
+        m_removed[at] = 1;
+        if (m_prev[at] != s_none) {
+            m_next[m_prev[at]] = m_next[at];
+        }
+        if (m_next[at] != s_none) {
+            m_prev[m_next[at]] = m_prev[at];
+        }
+    }
+
+    // Drops the removed instructions for good.
+    void compact(std::vector<Instr>& code)
+    {
+        size_t out = 0;
+        for (size_t i = 0; i < code.size(); i++) {
+            if (!m_removed[i]) {
+                m_effects[out] = m_effects[i];
+                code[out++] = code[i];
+            }
+        }
+        code.resize(out);
+        m_effects.resize(out);
+        link(code);
+    }
+
+    void rewrite(std::vector<Instr>& code, size_t at, const Instr& instr)
+    {
+        code[at] = instr;
+        m_effects[at] = effects(instr);
+    }
+
+    void enqueue(size_t at)
+    {
+        if (!m_queued[at] && !m_removed[at]) {
+            m_queued[at] = 1;
+            m_work.push_back(at);
+        }
+    }
+
+    // Queues whatever a change at `at` can affect: the instruction itself, its close neighbours, later
+    // readers of what it writes, and the next pop, whose pair may enclose the change.
+    void touch(const std::vector<Instr>& code, size_t at)
+    {
+        m_changed = true;
+        enqueue(at);
+        size_t count = 0;
+        for (size_t i = m_prev[at]; i != s_none && count < s_reach; i = m_prev[i]) {
+            if (!m_removed[i]) {
+                enqueue(i);
+                count++;
+            }
+        }
+        uint32_t mask = m_removed[at] ? 0 : m_effects[at].defs;
+        bool pop = false;
+        count = 0;
+        for (size_t i = m_next[at]; i != s_none && count < s_window && (mask != 0 || !pop); i = m_next[i]) {
+            if (m_removed[i]) {
+                continue;
+            }
+            Effects e = m_effects[i];
+            if (count++ < s_reach || (e.uses & mask) != 0 || (code[i].op == Op::pop && !pop)) {
+                enqueue(i);
+            }
+            if (e.barrier) {
+                break;
+            }
+            pop |= code[i].op == Op::pop;
+            mask &= ~e.defs;
+        }
+    }
+
+    // Queues the instructions before `at` that last wrote the registers in `mask`, which may have lost
+    // their only reader.
+    void touch_defs(size_t at, uint32_t mask)
+    {
+        size_t seen = 0;
+        for (size_t i = m_prev[at]; i != s_none && mask != 0 && ++seen <= s_window; i = m_prev[i]) {
+            Effects e = m_effects[i];
+            if (e.barrier) {
+                return;
+            }
+            if ((e.defs & mask) != 0) {
+                enqueue(i);
+                mask &= ~e.defs;
+            }
+        }
+    }
+
+    // Applies the rules to queued instructions until nothing changes any more.
+    void settle(std::vector<Instr>& code)
+    {
+        while (!m_work.empty()) {
+            size_t at = m_work.back();
+            m_work.pop_back();
+            m_queued[at] = 0;
+            if (m_removed[at]) {
+                continue;
+            }
+            if (code[at].op == Op::pop) {
+                fuse_push_pop(code, at);
+            }
+            if (!m_removed[at]) {
+                propagate_copies(code, at);
+            }
+            if (!m_removed[at]) {
+                remove_dead(code, at);
+            }
+        }
+    }
+
+    // Drops code between an unconditional jump and the next label, jumps to the label right after them
+    // and labels nothing jumps to. Dropping a label merges the code around it into one window.
+    bool remove_unreachable(std::vector<Instr>& code)
+    {
+        m_refs.clear();
+        for (const Instr& instr : code) {
+            if (instr.op == Op::jcc || instr.op == Op::jmp) {
+                if (instr.label >= m_refs.size()) {
+                    m_refs.resize(instr.label + 1, 0);
+                }
+                m_refs[instr.label]++;
+            }
+        }
+        auto referenced = [&](uint32_t label) { return label < m_refs.size() && m_refs[label] > 0; };
+
+        size_t out = 0;
+        bool reachable = true;
+        for (size_t i = 0; i < code.size(); i++) {
+            const Instr& instr = code[i];
+            bool keep = true;
+            if (instr.op == Op::label) {
+                keep = referenced(instr.label);
+                reachable |= keep;
+            }
+            else if (!reachable) {
+                keep = false;
+            }
+            else if ((instr.op == Op::jcc || instr.op == Op::jmp) && i + 1 < code.size()
+                && code[i + 1].op == Op::label && code[i + 1].label == instr.label) {
+                m_refs[instr.label]--;
+                keep = false;
+            }
+            else if (instr.op == Op::jmp) {
+                reachable = false;
+            }
+            if (keep) {
+                m_effects[out] = m_effects[i];
+                code[out++] = instr;
+            }
+        }
+        bool changed = out != code.size();
+        code.resize(out);
+        m_effects.resize(out);
+        link(code);
+        return changed;
+    }
+
+    // `push X; ...; pop Y` with nothing in between touching the stack becomes a move, placed at whichever
+    // end keeps the value intact.
+    void fuse_push_pop(std::vector<Instr>& code, size_t j)
+    {
+        uint32_t uses = 0;
+        uint32_t defs = 0;
+        size_t seen = 0;
+        for (size_t i = m_prev[j]; i != s_none && ++seen <= s_window; i = m_prev[i]) {
+            if (code[i].op == Op::push) {
+                const Operand value = code[i].dst;
+                Reg dst = code[j].dst.reg;
+                if (value.is_reg(dst) && (defs & bit(dst)) == 0) {
+                    remove(i);
+                    remove(j);
+                }
+                else if ((defs & regs(value)) == 0) {
+                    rewrite(code, j, { .op = Op::mov, .dst = Operand::of(dst), .src = value });
+                    remove(i);
+                }
+                else if (((uses | defs) & bit(dst)) == 0) {
+                    rewrite(code, i, { .op = Op::mov, .dst = Operand::of(dst), .src = value });
+                    remove(j);
+                }
+                else {
+                    return;
+                }
+                touch(code, i);
+                touch(code, j);
+                return;
+            }
+            Effects e = m_effects[i];
+            if (e.barrier || ((e.uses | e.defs) & bit(Reg::rsp)) != 0) {
+                return;
+            }
+            uses |= e.uses;
+            defs |= e.defs;
+        }
+    }
+
+    // The move that last wrote `reg` before instruction `at`, if that move copied a register or an
+    // immediate and the copied register still holds the same value at `at`.
+    [[nodiscard]] std::optional<size_t> forwarded(const std::vector<Instr>& code, size_t at, Reg reg) const
+    {
+        uint32_t defs = 0;
+        size_t seen = 0;
+        for (size_t i = m_prev[at]; i != s_none && ++seen <= s_window; i = m_prev[i]) {
+            Effects e = m_effects[i];
+            if (e.barrier) {
+                return {};
+            }
+            if ((e.defs & bit(reg)) == 0) {
+                defs |= e.defs;
+                continue;
+            }
+            const Instr& def = code[i];
+            if (def.op != Op::mov || def.src.kind == OperandKind::mem || def.src.is_reg(reg)
+                || (defs & regs(def.src)) != 0) {
+                return {};
+            }
+            return i;
+        }
+        return {};
+    }
+
+    // Like forwarded(), for operands that only take a register.
+    [[nodiscard]] std::optional<size_t> forwarded_reg(const std::vector<Instr>& code, size_t at, Reg reg) const
+    {
+        auto def = forwarded(code, at, reg);
+        if (!def.has_value() || code[def.value()].src.kind != OperandKind::reg) {
+            return {};
+        }
+        return def;
+    }
+
+    // Reads through a register that was just copied into go to the original register or immediate
+    // instead, which usually leaves the copy dead.
+    void propagate_copies(std::vector<Instr>& code, size_t at)
+    {
+        Instr& instr = code[at];
+        std::optional<size_t> def;
+        switch (instr.op) {
+        case Op::mov:
+            if (instr.dst.kind == OperandKind::reg && instr.src.kind == OperandKind::reg) {
+                if ((def = forwarded(code, at, instr.src.reg))) {
+                    instr.src = code[def.value()].src;
+                }
+            }
+            break;
+        case Op::add:
+        case Op::sub:
+        case Op::cmp:
+            if (instr.src.kind == OperandKind::reg) {
+                auto src = forwarded(code, at, instr.src.reg);
+                if (src.has_value()
+                    && (code[src.value()].src.kind == OperandKind::reg || fits_imm32(code[src.value()].src))) {
+                    instr.src = code[src.value()].src;
+                    def = src;
+                }
+            }
+            if (instr.op == Op::cmp && instr.dst.kind == OperandKind::reg) {
+                if (auto dst = forwarded_reg(code, at, instr.dst.reg)) {
+                    instr.dst = code[dst.value()].src;
+                    if (def.has_value()) {
+                        enqueue(def.value());
+                    }
+                    def = dst;
+                }
+            }
+            break;
+        case Op::test:
+            if (instr.dst.kind == OperandKind::reg && instr.src.is_reg(instr.dst.reg)) {
+                if ((def = forwarded_reg(code, at, instr.dst.reg))) {
+                    instr.dst = code[def.value()].src;
+                    instr.src = code[def.value()].src;
+                }
+            }
+            break;
+        case Op::mul:
+        case Op::div:
+            if (instr.dst.kind == OperandKind::reg) {
+                if ((def = forwarded_reg(code, at, instr.dst.reg))) {
+                    instr.dst = code[def.value()].src;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        if (def.has_value()) {
+            m_effects[at] = effects(instr);
+            enqueue(def.value());
+            touch(code, at);
+        }
+    }
+
+    // Drops self moves, additions of zero and pure instructions whose results are never read. Whatever
+    // fed a dropped instruction is looked at again, since it may have been its only reader.
+    void remove_dead(const std::vector<Instr>& code, size_t at)
+    {
+        const Instr& instr = code[at];
+        bool self_move = instr.op == Op::mov && instr.dst.kind == OperandKind::reg && instr.src.is_reg(instr.dst.reg);
+        bool zero_add = (instr.op == Op::add || instr.op == Op::sub) && instr.src.kind == OperandKind::imm
+            && instr.src.value == 0 && is_dead(at, s_flags);
+        if (self_move || zero_add || (is_pure(instr) && is_dead(at, m_effects[at].defs))) {
+            remove(at);
+            touch_defs(at, m_effects[at].uses);
+            touch(code, at);
+        }
+    }
+
+    // `mov reg, 0` becomes the shorter `xor reg, reg` wherever the flags it clobbers are not needed.
+    void use_zero_idioms(std::vector<Instr>& code)
+    {
+        for (size_t i = 0; i < code.size(); i++) {
+            Instr& instr = code[i];
+            if (instr.op == Op::mov && instr.dst.kind == OperandKind::reg && instr.src.kind == OperandKind::imm
+                && instr.src.value == 0 && is_dead(i, s_flags)) {
+                instr = { .op = Op::_xor, .dst = instr.dst, .src = instr.dst };
+                m_effects[i] = effects(instr);
+            }
+        }
+    }
+
+    // Scratch space kept across rounds, indexed like the code. The live instructions form a doubly linked
+    // list, so removing one costs nothing until the next compact(). Effects are worked out once per
+    // instruction rather than on every look.
+    std::vector<Effects> m_effects;
+    std::vector<size_t> m_prev;
+    std::vector<size_t> m_next;
+    std::vector<uint8_t> m_removed;
+    std::vector<uint8_t> m_queued;
+    std::vector<size_t> m_work;
+    std::vector<uint32_t> m_refs;
+    bool m_changed = false;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "instruction.hpp"
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+// Linear scan register allocation over the live ranges of `let` bound variables.
+// Variables are immutable and the language has no loops, so a live range is simply the
+// interval from the point a variable is bound to the point of its last use in program order.
+class RegisterAllocator {
+public:
+    // rax, rbx, rcx and rdx are scratch registers of the expression evaluator and rdi carries the exit code.
+    static constexpr std::array<Reg, 9> s_registers
+        = { Reg::r12, Reg::r13, Reg::r14, Reg::r15, Reg::rsi, Reg::r8, Reg::r9, Reg::r10, Reg::r11 };
+
+    inline explicit RegisterAllocator(const NodeProgram& program)
+        : m_program(program)
+    {
+    }
+
+    // Maps every register resident `let` to its register. Variables missing from the map are spilled
+    // and keep living in their stack slot.
+    [[nodiscard]] std::unordered_map<const NodeStmtLet*, Reg> allocate()
+    {
+        for (const NodeStmt* stmt : m_program.statements) {
+            visit_stmt(stmt);
+        }
+
+        std::unordered_map<const NodeStmtLet*, Reg> assignment;
+        std::vector<Reg> free_regs(s_registers.rbegin(), s_registers.rend());
+        std::vector<Interval*> active;
+
+        // Intervals are created in the order they start, so no sorting is required.
+        for (Interval& interval : m_intervals) {
+            // Expire every interval that ended before this one starts.
+            std::erase_if(active, [&](const Interval* other) {
+                if (other->end >= interval.start) {
+                    return false;
+                }
+                free_regs.push_back(assignment.at(other->let));
+                return true;
+            });
+
+            if (!free_regs.empty()) {
+                assignment[interval.let] = free_regs.back();
+                free_regs.pop_back();
+                active.push_back(&interval);
+                continue;
+            }
+
+            // Under pressure, spill whichever interval lives the longest.
+            auto furthest = std::max_element(active.begin(), active.end(), [](const Interval* a, const Interval* b) {
+                return a->end < b->end;
+            });
+            if (furthest != active.end() && (*furthest)->end > interval.end) {
+                assignment[interval.let] = assignment.at((*furthest)->let);
+                assignment.erase((*furthest)->let);
+                *furthest = &interval;
+            }
+        }
+        return assignment;
+    }
+
+private:
+    struct Interval {
+        const NodeStmtLet* let;
+        size_t start;
+        size_t end;
+    };
+
+    void visit_expr(const NodeExpr* expr)
+    {
+        struct ExprVisitor {
+            RegisterAllocator* alloc;
+            void operator()(const NodeTermIntLit&) const
+            {
+            }
+            void operator()(const NodeTermIdent& term_ident) const
+            {
+                // Undeclared identifiers are reported by the generator.
+                if (const size_t* interval = alloc->m_bindings.find(term_ident.name)) {
+                    alloc->m_intervals[*interval].end = alloc->m_point;
+                }
+                alloc->m_point++;
+            }
+            void operator()(const NodeTermParen& term_paren) const
+            {
+                alloc->visit_expr(term_paren.expr);
+            }
+            void operator()(const NodeBinExpr& bin_expr) const
+            {
+                // Operands are generated right to left.
+                alloc->visit_expr(bin_expr.rhs);
+                alloc->visit_expr(bin_expr.lhs);
+            }
+        };
+        std::visit(ExprVisitor { .alloc = this }, expr->var);
+    }
+
+    void visit_scope(const NodeScope* scope)
+    {
+        m_bindings.push_scope();
+        for (const NodeStmt* stmt : scope->stmts) {
+            visit_stmt(stmt);
+        }
+        m_bindings.pop_scope();
+    }
+
+    void visit_stmt(const NodeStmt* stmt)
+    {
+        struct StmtVisitor {
+            RegisterAllocator* alloc;
+            void operator()(const NodeStmtExit* stmt_exit) const
+            {
+                alloc->visit_expr(stmt_exit->expr);
+            }
+            void operator()(const NodeStmtLet* stmt_let) const
+            {
+                // The value is fully computed on the stack before it is bound, so the new variable
+                // may reuse the register of one whose last use is inside its initializer.
+                alloc->visit_expr(stmt_let->expr);
+                alloc->m_bindings.declare(stmt_let->name, alloc->m_intervals.size());
+                alloc->m_intervals.push_back({ .let = stmt_let, .start = alloc->m_point, .end = alloc->m_point });
+                alloc->m_point++;
+            }
+            void operator()(const NodeScope* scope) const
+            {
+                alloc->visit_scope(scope);
+            }
+            void operator()(const NodeStmtIf* stmt_if) const
+            {
+                alloc->visit_expr(stmt_if->expr);
+                alloc->visit_scope(stmt_if->scope);
+            }
+        };
+        std::visit(StmtVisitor { .alloc = this }, stmt->var);
+    }
+
+    const NodeProgram& m_program;
+    std::vector<Interval> m_intervals {};
+    SymbolTable<size_t> m_bindings {};
+    size_t m_point = 0;
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HELIX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Run scanning kernels for the tokenizer. Each kernel returns the first position in [p, end) that
+// does not continue the run (or that matches, for find_newline), or `end`.
+struct ScanKernels {
+    const char* (*skip_whitespace)(const char* p, const char* end);
+    const char* (*find_newline)(const char* p, const char* end);
+    const char* (*skip_ident)(const char* p, const char* end);
+    const char* (*skip_digits)(const char* p, const char* end);
+};
+
+namespace scan_scalar {
+
+inline bool is_space(char c)
+{
+    return c == ' ' || static_cast<uint8_t>(c - '\t') <= '\r' - '\t';
+}
+
+inline bool is_digit(char c)
+{
+    return static_cast<uint8_t>(c - '0') <= 9;
+}
+
+inline bool is_ident(char c)
+{
+    return is_digit(c) || static_cast<uint8_t>((c | 0x20) - 'a') <= 'z' - 'a';
+}
+
+inline const char* skip_whitespace(const char* p, const char* end)
+{
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* find_newline(const char* p, const char* end)
+{
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+inline const char* skip_ident(const char* p, const char* end)
+{
+    while (p < end && is_ident(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* skip_digits(const char* p, const char* end)
+{
+    while (p < end && is_digit(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline constexpr ScanKernels kernels { skip_whitespace, find_newline, skip_ident, skip_digits };
+
+} // namespace scan_scalar
+
+#ifdef HELIX_SIMD_X86
+
+// SSE2 is part of the x86-64 baseline, so these need no runtime check.
+namespace scan_sse2 {
+
+inline __m128i in_range(__m128i v, char lo, char hi)
+{
+    __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(lo)), v);
+    __m128i below = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(hi)), v);
+    return _mm_and_si128(above, below);
+}
+
+inline __m128i space_mask(__m128i v)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range(v, '\t', '\r'));
+}
+
+inline __m128i digit_mask(__m128i v)
+{
+    return in_range(v, '0', '9');
+}
+
+inline __m128i ident_mask(__m128i v)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range(lower, 'a', 'z'), digit_mask(v));
+}
+
+// Advances 16 bytes at a time while every byte is in the class, then finishes with the scalar loop.
+template <__m128i (*Mask)(__m128i)>
+inline const char* skip_class(const char* p, const char* end, const char* (*tail)(const char*, const char*))
+{
+    while (end - p >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto outside = static_cast<uint32_t>(~_mm_movemask_epi8(Mask(v))) & 0xFFFF;
+        if (outside != 0) {
+            return p + __builtin_ctz(outside);
+        }
+        p += 16;
+    }
+    return tail(p, end);
+}
+
+inline const char* skip_whitespace(const char* p, const char* end)
+{
+    return skip_class<space_mask>(p, end, scan_scalar::skip_whitespace);
+}
+
+inline const char* find_newline(const char* p, const char* end)
+{
+    while (end - p >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto hits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+        if (hits != 0) {
+            return p + __builtin_ctz(hits);
+        }
+        p += 16;
+    }
+    return scan_scalar::find_newline(p, end);
+}
+
+inline const char* skip_ident(const char* p, const char* end)
+{
+    return skip_class<ident_mask>(p, end, scan_scalar::skip_ident);
+}
+
+inline const char* skip_digits(const char* p, const char* end)
+{
+    return skip_class<digit_mask>(p, end, scan_scalar::skip_digits);
+}
+
+inline constexpr ScanKernels kernels { skip_whitespace, find_newline, skip_ident, skip_digits };
+
+} // namespace scan_sse2
+
+namespace scan_avx2 {
+
+#define HELIX_AVX2 __attribute__((target("avx2")))
+
+HELIX_AVX2 inline __m256i in_range(__m256i v, char lo, char hi)
+{
+    __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(lo)), v);
+    __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(hi)), v);
+    return _mm256_and_si256(above, below);
+}
+
+HELIX_AVX2 inline __m256i space_mask(__m256i v)
+{
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range(v, '\t', '\r'));
+}
+
+HELIX_AVX2 inline __m256i digit_mask(__m256i v)
+{
+    return in_range(v, '0', '9');
+}
+
+HELIX_AVX2 inline __m256i ident_mask(__m256i v)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(in_range(lower, 'a', 'z'), digit_mask(v));
+}
+
+// Same as the SSE2 version with 32 byte strides; the remainder goes through SSE2.
+template <__m256i (*Mask)(__m256i)>
+HELIX_AVX2 inline const char* skip_class(const char* p, const char* end, const char* (*tail)(const char*, const char*))
+{
+    while (end - p >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto outside = ~static_cast<uint32_t>(_mm256_movemask_epi8(Mask(v)));
+        if (outside != 0) {
+            return p + __builtin_ctz(outside);
+        }
+        p += 32;
+    }
+    return tail(p, end);
+}
+
+HELIX_AVX2 inline const char* skip_whitespace(const char* p, const char* end)
+{
+    return skip_class<space_mask>(p, end, scan_sse2::skip_whitespace);
+}
+
+HELIX_AVX2 inline const char* find_newline(const char* p, const char* end)
+{
+    while (end - p >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto hits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+        if (hits != 0) {
+            return p + __builtin_ctz(hits);
+        }
+        p += 32;
+    }
+    return scan_sse2::find_newline(p, end);
+}
+
+HELIX_AVX2 inline const char* skip_ident(const char* p, const char* end)
+{
+    return skip_class<ident_mask>(p, end, scan_sse2::skip_ident);
+}
+
+HELIX_AVX2 inline const char* skip_digits(const char* p, const char* end)
+{
+    return skip_class<digit_mask>(p, end, scan_sse2::skip_digits);
+}
+
+#undef HELIX_AVX2
+
+inline constexpr ScanKernels kernels { skip_whitespace, find_newline, skip_ident, skip_digits };
+
+} // namespace scan_avx2
+
+#endif
+
+// Picks the widest kernels the running CPU supports, once per process.
+inline const ScanKernels& scan_kernels()
+{
+#ifdef HELIX_SIMD_X86
+    static const ScanKernels& selected = __builtin_cpu_supports("avx2") ? scan_avx2::kernels : scan_sse2::kernels;
+    return selected;
+#else
+    return scan_scalar::kernels;
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compile_error.hpp"
+
+// Read only memory mapping of a source file. Tokens and AST nodes refer back into the mapped bytes,
+// so a SourceFile has to outlive every stage that consumes its contents.
+class SourceFile {
+public:
+    inline explicit SourceFile(const std::string& path)
+    {
+        m_fd = open(path.c_str(), O_RDONLY);
+        if (m_fd < 0) {
+            throw CompileError("Unable to open " + path);
+        }
+        struct stat st { };
+        if (fstat(m_fd, &st) < 0) {
+            close(m_fd);
+            throw CompileError("Unable to stat " + path);
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        // mmap rejects zero length mappings; an empty file is just an empty view.
+        if (m_size == 0) {
+            return;
+        }
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (data == MAP_FAILED) {
+            close(m_fd);
+            throw CompileError("Unable to map " + path);
+        }
+        madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(data);
+    }
+
+    // CPPCHECK - noCopyConstructor
+    inline SourceFile(const SourceFile& other) = delete;
+
+    // CPPCHECK - noOperatorEq
+    inline SourceFile& operator=(const SourceFile& other) = delete;
+
+    inline ~SourceFile()
+    {
+        if (m_data != nullptr) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    [[nodiscard]] inline std::string_view contents() const
+    {
+        return { m_data, m_size };
+    }
+
+private:
+    int m_fd = -1;
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <type_traits>
+#include <vector>
+
+#include "output_sink.hpp"
+
+// Wall and CPU time per compiler phase plus named counters, for --time-passes and --stats. CPU time is
+// that of the calling thread, so compiles running side by side in a batch don't count each other's work;
+// phases that run an external assembler or linker add the CPU time of child processes. Timing a phase
+// that was already timed adds to it, which is how passes repeated by the pass manager are reported.
+class CompileStats {
+public:
+    // Runs `fn` as the phase `name` and returns its result.
+    template <typename Fn>
+    decltype(auto) time(std::string_view name, Fn&& fn)
+    {
+        Clock start = now(false);
+        if constexpr (std::is_void_v<decltype(fn())>) {
+            fn();
+            record(name, start, false);
+        }
+        else {
+            decltype(auto) result = fn();
+            record(name, start, false);
+            return result;
+        }
+    }
+
+    // Runs `fn`, which waits for an external program, as the phase `name`. Child CPU time is only known
+    // for the process as a whole, so it includes children that other threads ran meanwhile.
+    template <typename Fn>
+    void time_external(std::string_view name, Fn&& fn)
+    {
+        Clock start = now(true);
+        fn();
+        record(name, start, true);
+    }
+
+    void count(std::string_view name, uint64_t value)
+    {
+        for (Counter& counter : m_counters) {
+            if (counter.name == name) {
+                counter.value = value;
+                return;
+            }
+        }
+        m_counters.push_back({ .name = name, .value = value });
+    }
+
+    // Peak resident set size of the whole process so far, in bytes.
+    [[nodiscard]] static uint64_t peak_rss()
+    {
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+#if __APPLE__
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+    void print_timings(OutputSink& out) const
+    {
+        Clock total {};
+        out << "===== Phase timings =====\n";
+        out << "     wall ms      cpu ms  phase\n";
+        for (const Phase& phase : m_phases) {
+            print_row(out, phase.elapsed, phase.name);
+            total.wall_ns += phase.elapsed.wall_ns;
+            total.cpu_ns += phase.elapsed.cpu_ns;
+        }
+        print_row(out, total, "total");
+    }
+
+    void print_counters(OutputSink& out) const
+    {
+        out << "===== Statistics =====\n";
+        for (const Counter& counter : m_counters) {
+            print_right(out, std::to_string(counter.value), 12);
+            out << "  " << counter.name << "\n";
+        }
+    }
+
+    // Both sections as one JSON object for the compile of `file`, with times in nanoseconds.
+    void print_json(OutputSink& out, std::string_view file, bool timings, bool counters) const
+    {
+        out << "{\"file\": \"";
+        for (char c : file) {
+            if (c == '"' || c == '\\') {
+                out << '\\';
+            }
+            out << c;
+        }
+        out << "\"";
+        if (timings) {
+            out << ", \"phases\": [";
+            for (size_t i = 0; i < m_phases.size(); i++) {
+                const Phase& phase = m_phases[i];
+                out << (i > 0 ? ", " : "") << "{\"name\": \"" << phase.name << "\", ";
+                out << "\"wall_ns\": " << phase.elapsed.wall_ns << ", \"cpu_ns\": " << phase.elapsed.cpu_ns << "}";
+            }
+            out << "]";
+        }
+        if (counters) {
+            out << ", \"stats\": {";
+            for (size_t i = 0; i < m_counters.size(); i++) {
+                out << (i > 0 ? ", " : "") << "\"" << m_counters[i].name << "\": " << m_counters[i].value;
+            }
+            out << "}";
+        }
+        out << "}\n";
+    }
+
+private:
+    struct Clock {
+        uint64_t wall_ns;
+        uint64_t cpu_ns;
+    };
+
+    struct Phase {
+        std::string_view name;
+        Clock elapsed;
+    };
+
+    struct Counter {
+        std::string_view name;
+        uint64_t value;
+    };
+
+    [[nodiscard]] static uint64_t nanoseconds(clockid_t clock)
+    {
+        timespec ts {};
+        clock_gettime(clock, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    [[nodiscard]] static Clock now(bool children)
+    {
+        uint64_t children_ns = 0;
+        if (children) {
+            rusage usage {};
+            getrusage(RUSAGE_CHILDREN, &usage);
+            for (const timeval& tv : { usage.ru_utime, usage.ru_stime }) {
+                children_ns += static_cast<uint64_t>(tv.tv_sec) * 1000000000 + static_cast<uint64_t>(tv.tv_usec) * 1000;
+            }
+        }
+        return { .wall_ns = nanoseconds(CLOCK_MONOTONIC),
+                 .cpu_ns = nanoseconds(CLOCK_THREAD_CPUTIME_ID) + children_ns };
+    }
+
+    void record(std::string_view name, Clock start, bool children)
+    {
+        Clock end = now(children);
+        Clock elapsed { .wall_ns = end.wall_ns - start.wall_ns, .cpu_ns = end.cpu_ns - start.cpu_ns };
+        for (Phase& phase : m_phases) {
+            if (phase.name == name) {
+                phase.elapsed.wall_ns += elapsed.wall_ns;
+                phase.elapsed.cpu_ns += elapsed.cpu_ns;
+                return;
+            }
+        }
+        m_phases.push_back({ .name = name, .elapsed = elapsed });
+    }
+
+    static void print_right(OutputSink& out, std::string_view text, size_t width)
+    {
+        for (size_t i = text.size(); i < width; i++) {
+            out << ' ';
+        }
+        out << text;
+    }
+
+    // Milliseconds with three decimals, right aligned in 12 columns.
+    static void print_ms(OutputSink& out, uint64_t ns)
+    {
+        uint64_t us = ns / 1000;
+        std::string fraction = std::to_string(us % 1000);
+        print_right(out, std::to_string(us / 1000) + "." + std::string(3 - fraction.size(), '0') + fraction, 12);
+    }
+
+    static void print_row(OutputSink& out, Clock clock, std::string_view name)
+    {
+        print_ms(out, clock.wall_ns);
+        print_ms(out, clock.cpu_ns);
+        out << "  " << name << "\n";
+    }
+
+    std::vector<Phase> m_phases {};
+    std::vector<Counter> m_counters {};
+};
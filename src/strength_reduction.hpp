@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "instruction.hpp"
+
+// Multiplication, division and modulo by constants without mul or div. Both code generators keep the
+// operand in rax and expect a product or quotient back in rax and a remainder in rdx, like the
+// instructions these sequences replace.
+
+struct UnsignedMagic {
+    uint64_t multiplier;
+    uint8_t shift;
+    // The exact multiplier needs 65 bits; the top bit is accounted for by an extra subtract, shift and add.
+    bool add;
+};
+
+// Reciprocal for dividing by `divisor` with a multiply high and a shift, which must not be zero or a power
+// of two. Uses the round up method of Granlund and Montgomery, in the formulation libdivide uses.
+[[nodiscard]] inline UnsignedMagic unsigned_magic(uint64_t divisor)
+{
+    auto floor_log2 = static_cast<uint8_t>(63 - std::countl_zero(divisor));
+    unsigned __int128 numerator = static_cast<unsigned __int128>(1) << (64 + floor_log2);
+    auto proposed = static_cast<uint64_t>(numerator / divisor);
+    auto rem = static_cast<uint64_t>(numerator % divisor);
+    if (divisor - rem < (uint64_t(1) << floor_log2)) {
+        return { .multiplier = proposed + 1, .shift = floor_log2, .add = false };
+    }
+    proposed += proposed;
+    uint64_t twice_rem = rem + rem;
+    if (twice_rem >= divisor || twice_rem < rem) {
+        proposed++;
+    }
+    return { .multiplier = proposed + 1, .shift = floor_log2, .add = true };
+}
+
+// rax = rax * factor, wrapping. Clobbers rcx.
+inline void emit_mul_by_constant(std::vector<Instr>& code, uint64_t factor)
+{
+    const Operand rax = Operand::of(Reg::rax);
+    auto emit = [&](Op op, Operand dst, Operand src) { code.push_back({ .op = op, .dst = dst, .src = src }); };
+    // lea computes rax * 3, 5 or 9 in one cycle.
+    auto lea = [&](uint64_t by) {
+        emit(Op::lea, rax, Operand::mem(Reg::rax, Reg::rax, static_cast<uint8_t>(by - 1), 0));
+    };
+
+    if (factor == 0) {
+        emit(Op::mov, rax, Operand::imm(0));
+        return;
+    }
+    // factor = odd << shift, where odd is 1 or a product of at most two lea factors.
+    int shift = std::countr_zero(factor);
+    uint64_t odd = factor >> shift;
+    std::array<uint64_t, 2> leas {};
+    size_t lea_count = 0;
+    for (uint64_t by : { 9, 5, 3 }) {
+        while (odd % by == 0 && lea_count < leas.size()) {
+            leas[lea_count++] = by;
+            odd /= by;
+        }
+    }
+    if (odd != 1) {
+        if (factor <= INT32_MAX) {
+            emit(Op::imul, rax, Operand::imm(static_cast<int64_t>(factor)));
+            return;
+        }
+        emit(Op::mov, Operand::of(Reg::rcx), Operand::imm(static_cast<int64_t>(factor)));
+        emit(Op::imul, rax, Operand::of(Reg::rcx));
+        return;
+    }
+    for (size_t i = 0; i < lea_count; i++) {
+        lea(leas[i]);
+    }
+    if (shift > 0) {
+        emit(Op::shl, rax, Operand::imm(shift));
+    }
+}
+
+// rax = rax / divisor, or rdx = rax % divisor if `remainder` is set, both unsigned. The divisor must not be
+// zero; division by zero is left to div so that it traps. Clobbers rax, rbx, rcx and rdx.
+inline void emit_div_by_constant(std::vector<Instr>& code, uint64_t divisor, bool remainder)
+{
+    const Operand rax = Operand::of(Reg::rax);
+    const Operand rbx = Operand::of(Reg::rbx);
+    const Operand rcx = Operand::of(Reg::rcx);
+    const Operand rdx = Operand::of(Reg::rdx);
+    auto emit = [&](Op op, Operand dst, Operand src) { code.push_back({ .op = op, .dst = dst, .src = src }); };
+    // Uses rcx for immediates an instruction cannot encode.
+    auto imm32 = [&](uint64_t value) {
+        if (value <= INT32_MAX) {
+            return Operand::imm(static_cast<int64_t>(value));
+        }
+        emit(Op::mov, rcx, Operand::imm(static_cast<int64_t>(value)));
+        return rcx;
+    };
+
+    if (std::has_single_bit(divisor)) {
+        if (remainder && divisor == 1) {
+            emit(Op::mov, rdx, Operand::imm(0));
+        }
+        else if (remainder) {
+            emit(Op::mov, rdx, rax);
+            emit(Op::_and, rdx, imm32(divisor - 1));
+        }
+        else if (divisor > 1) {
+            emit(Op::shr, rax, Operand::imm(std::countr_zero(divisor)));
+        }
+        return;
+    }
+
+    UnsignedMagic magic = unsigned_magic(divisor);
+    emit(Op::mov, rbx, rax);
+    emit(Op::mov, rcx, Operand::imm(static_cast<int64_t>(magic.multiplier)));
+    emit(Op::mul, rcx, {});
+    // rdx is now the high half of dividend * multiplier.
+    if (magic.add) {
+        emit(Op::mov, rax, rbx);
+        emit(Op::sub, rax, rdx);
+        emit(Op::shr, rax, Operand::imm(1));
+        emit(Op::add, rax, rdx);
+    }
+    else {
+        emit(Op::mov, rax, rdx);
+    }
+    if (magic.shift > 0) {
+        emit(Op::shr, rax, Operand::imm(magic.shift));
+    }
+    if (remainder) {
+        // dividend - quotient * divisor
+        emit(Op::mov, rdx, rax);
+        emit(Op::imul, rdx, imm32(divisor));
+        emit(Op::sub, rbx, rdx);
+        emit(Op::mov, rdx, rbx);
+    }
+}
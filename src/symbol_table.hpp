@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Maps identifier names to dense ids through an open addressing hash table with linear probing.
+// Names are views, so whatever they point into has to outlive the interner.
+class StringInterner {
+public:
+    inline uint32_t intern(std::string_view name)
+    {
+        uint64_t hash = hash_name(name);
+        size_t slot = probe(name, hash);
+        if (m_slots[slot] != s_empty) {
+            return m_slots[slot];
+        }
+        auto id = static_cast<uint32_t>(m_names.size());
+        m_names.push_back(name);
+        m_hashes.push_back(hash);
+        m_slots[slot] = id;
+        // Keep the load factor at or below one half.
+        if (m_names.size() * 2 > m_slots.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    [[nodiscard]] inline std::optional<uint32_t> find(std::string_view name) const
+    {
+        uint32_t id = m_slots[probe(name, hash_name(name))];
+        if (id == s_empty) {
+            return {};
+        }
+        return id;
+    }
+
+    [[nodiscard]] inline std::string_view name(uint32_t id) const
+    {
+        return m_names[id];
+    }
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return m_names.size();
+    }
+
+private:
+    static constexpr uint32_t s_empty = UINT32_MAX;
+
+    // FNV-1a, plenty for short identifiers.
+    static inline uint64_t hash_name(std::string_view name)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (char c : name) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    // Slot holding `name`, or the empty slot where it would be inserted.
+    [[nodiscard]] inline size_t probe(std::string_view name, uint64_t hash) const
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t slot = hash & mask;
+        while (m_slots[slot] != s_empty) {
+            uint32_t id = m_slots[slot];
+            if (m_hashes[id] == hash && m_names[id] == name) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    inline void grow()
+    {
+        m_slots.assign(m_slots.size() * 2, s_empty);
+        size_t mask = m_slots.size() - 1;
+        for (uint32_t id = 0; id < m_names.size(); id++) {
+            size_t slot = m_hashes[id] & mask;
+            while (m_slots[slot] != s_empty) {
+                slot = (slot + 1) & mask;
+            }
+            m_slots[slot] = id;
+        }
+    }
+
+    std::vector<uint32_t> m_slots = std::vector<uint32_t>(64, s_empty);
+    std::vector<std::string_view> m_names {};
+    std::vector<uint64_t> m_hashes {};
+};
+
+// Scoped bindings from interned identifiers to `Value`. Lookups index straight into a per id table
+// holding the innermost binding, and popping a scope restores whatever the scope's bindings shadowed,
+// so neither lookups nor scope exits rescan the bindings.
+template <typename Value>
+class SymbolTable {
+public:
+    struct Entry {
+        uint32_t id;
+        // Binding of the same identifier this one shadows, or s_none.
+        uint32_t shadowed;
+        Value value;
+    };
+
+    inline void push_scope()
+    {
+        m_scopes.push_back(m_entries.size());
+    }
+
+    inline void pop_scope()
+    {
+        size_t mark = m_scopes.back();
+        m_scopes.pop_back();
+        while (m_entries.size() > mark) {
+            const Entry& entry = m_entries.back();
+            m_innermost[entry.id] = entry.shadowed;
+            m_entries.pop_back();
+        }
+    }
+
+    // Bindings made since the innermost push_scope(), in declaration order.
+    [[nodiscard]] inline std::span<const Entry> innermost_scope() const
+    {
+        size_t mark = m_scopes.empty() ? 0 : m_scopes.back();
+        return { m_entries.data() + mark, m_entries.size() - mark };
+    }
+
+    inline void declare(std::string_view name, Value value)
+    {
+        uint32_t id = m_interner.intern(name);
+        if (id >= m_innermost.size()) {
+            m_innermost.resize(id + 1, s_none);
+        }
+        m_entries.push_back({ .id = id, .shadowed = m_innermost[id], .value = std::move(value) });
+        m_innermost[id] = static_cast<uint32_t>(m_entries.size() - 1);
+    }
+
+    [[nodiscard]] inline Value* find(std::string_view name)
+    {
+        auto id = m_interner.find(name);
+        if (!id.has_value() || id.value() >= m_innermost.size() || m_innermost[id.value()] == s_none) {
+            return nullptr;
+        }
+        return &m_entries[m_innermost[id.value()]].value;
+    }
+
+private:
+    static constexpr uint32_t s_none = UINT32_MAX;
+
+    StringInterner m_interner {};
+    std::vector<uint32_t> m_innermost {};
+    std::vector<Entry> m_entries {};
+    std::vector<size_t> m_scopes {};
+};
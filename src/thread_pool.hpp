@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks. Every worker owns a deque: tasks submitted from a
+// worker go to the back of its own deque, tasks from outside are dealt round robin, a worker takes its
+// next task from the back of its own deque and, when that runs dry, steals from the front of the others.
+// Uneven batches therefore keep every thread busy without a single shared queue to fight over.
+class ThreadPool {
+public:
+    inline explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+    {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; i++) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threads; i++) {
+            m_threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    // CPPCHECK - noCopyConstructor
+    inline ThreadPool(const ThreadPool& other) = delete;
+
+    // CPPCHECK - noOperatorEq
+    inline ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    // Finishes every submitted task before joining the workers.
+    inline ~ThreadPool()
+    {
+        wait();
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_work_available.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    inline void submit(std::function<void()> task)
+    {
+        size_t index = t_pool == this ? t_worker : m_next_queue++ % m_queues.size();
+        // Counted first, so a worker that takes the task right away can never drive the counts below zero.
+        {
+            std::lock_guard lock(m_mutex);
+            m_queued++;
+            m_pending++;
+        }
+        {
+            std::lock_guard lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        m_work_available.notify_one();
+    }
+
+    // Blocks until every task submitted so far has finished.
+    inline void wait()
+    {
+        std::unique_lock lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return m_threads.size();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    inline void work(size_t index)
+    {
+        t_pool = this;
+        t_worker = index;
+        while (true) {
+            std::function<void()> task;
+            if (take(index, task)) {
+                task();
+                std::lock_guard lock(m_mutex);
+                if (--m_pending == 0) {
+                    m_idle.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock lock(m_mutex);
+            m_work_available.wait(lock, [this] { return m_stopping || m_queued > 0; });
+            if (m_stopping && m_queued == 0) {
+                return;
+            }
+        }
+    }
+
+    // Pops from the back of the worker's own deque, or steals from the front of another one.
+    inline bool take(size_t index, std::function<void()>& task)
+    {
+        for (size_t i = 0; i < m_queues.size(); i++) {
+            Queue& queue = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard count_lock(m_mutex);
+            m_queued--;
+            return true;
+        }
+        return false;
+    }
+
+    static inline thread_local const ThreadPool* t_pool = nullptr;
+    static inline thread_local size_t t_worker = 0;
+
+    std::vector<std::unique_ptr<Queue>> m_queues {};
+    std::vector<std::thread> m_threads {};
+    std::atomic<size_t> m_next_queue = 0;
+    std::mutex m_mutex {};
+    std::condition_variable m_work_available {};
+    std::condition_variable m_idle {};
+    // Tasks sitting in a deque, and tasks submitted but not yet finished; both guarded by m_mutex.
+    size_t m_queued = 0;
+    size_t m_pending = 0;
+    bool m_stopping = false;
+};
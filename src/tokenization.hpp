@@ -1,9 +1,20 @@
 #pragma once
 
+#include "array"
+#include "charconv"
+#include "cstdint"
+#include "exception"
+#include "iostream"
+#include "optional"
 #include "string"
+#include "string_view"
 #include "vector"
 
-enum class TokenType {
+#include "compile_error.hpp"
+#include "simd_scan.hpp"
+#include "thread_pool.hpp"
+
+enum class TokenType : uint8_t {
     exit,
     int_lit,
     semi,
@@ -73,172 +84,387 @@ std::optional<int> bin_prec(TokenType type)
     }
 }
 
+// Eight bytes per token. An identifier is `length` bytes at source offset `payload`, so the source has to
+// outlive the tokens; an integer literal is already parsed, `payload` is its index in the tokenizer's
+// literal table. Every other token is just its type.
 struct Token {
     TokenType type;
-    std::optional<std::string> value {};
+    uint16_t length = 0;
+    uint32_t payload = 0;
+};
+
+static_assert(sizeof(Token) == 8);
+
+// Literal table slots of `false` and `true`, present in every table.
+inline constexpr uint32_t literal_false = 0;
+inline constexpr uint32_t literal_true = 1;
+
+// Lexer tables, all generated at compile time.
+enum class CharClass : uint8_t {
+    invalid,
+    space,
+    alpha,
+    digit,
+    // Always a single character token.
+    single,
+    // `<`, `>`, `=` and `!`, which form a two character token when followed by `=`.
+    op_eq,
+    slash,
 };
 
+constexpr std::array<CharClass, 256> make_char_classes()
+{
+    std::array<CharClass, 256> classes {};
+    for (int c = 0; c < 256; c++) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            classes[c] = CharClass::alpha;
+        }
+        else if (c >= '0' && c <= '9') {
+            classes[c] = CharClass::digit;
+        }
+    }
+    for (char c : std::string_view(" \t\n\v\f\r")) {
+        classes[static_cast<uint8_t>(c)] = CharClass::space;
+    }
+    for (char c : std::string_view("(){}+-*%;")) {
+        classes[static_cast<uint8_t>(c)] = CharClass::single;
+    }
+    for (char c : std::string_view("<>=!")) {
+        classes[static_cast<uint8_t>(c)] = CharClass::op_eq;
+    }
+    classes['/'] = CharClass::slash;
+    return classes;
+}
+
+// Token produced by a `single` or `op_eq` character on its own, and by an `op_eq` character followed by `=`.
+struct OpTokens {
+    std::array<TokenType, 256> single;
+    std::array<TokenType, 256> with_eq;
+};
+
+constexpr OpTokens make_op_tokens()
+{
+    OpTokens ops {};
+    ops.single['('] = TokenType::open_parenthesis;
+    ops.single[')'] = TokenType::close_parenthesis;
+    ops.single['{'] = TokenType::open_curly;
+    ops.single['}'] = TokenType::close_curly;
+    ops.single['+'] = TokenType::plus;
+    ops.single['-'] = TokenType::sub;
+    ops.single['*'] = TokenType::star;
+    ops.single['%'] = TokenType::modulo;
+    ops.single[';'] = TokenType::semi;
+    ops.single['/'] = TokenType::div;
+    ops.single['<'] = TokenType::lt;
+    ops.single['>'] = TokenType::gt;
+    ops.single['='] = TokenType::eq;
+    ops.with_eq['<'] = TokenType::lte;
+    ops.with_eq['>'] = TokenType::gte;
+    ops.with_eq['='] = TokenType::equality;
+    ops.with_eq['!'] = TokenType::not_equality;
+    return ops;
+}
+
+inline constexpr std::array<CharClass, 256> char_classes = make_char_classes();
+inline constexpr OpTokens op_tokens = make_op_tokens();
+
+struct Keyword {
+    std::string_view text;
+    Token token;
+};
+
+inline constexpr std::array<Keyword, 5> keywords = { {
+    { "exit", { .type = TokenType::exit } },
+    { "let", { .type = TokenType::let } },
+    { "if", { .type = TokenType::_if } },
+    { "true", { .type = TokenType::int_lit, .payload = literal_true } },
+    { "false", { .type = TokenType::int_lit, .payload = literal_false } },
+} };
+
+inline constexpr size_t keyword_table_size = 16;
+
+constexpr size_t keyword_hash(std::string_view word, uint32_t seed)
+{
+    auto first = static_cast<uint8_t>(word.front());
+    auto last = static_cast<uint8_t>(word.back());
+    return (first * seed + last + word.size()) & (keyword_table_size - 1);
+}
+
+// Smallest seed for which keyword_hash maps every keyword to its own slot.
+consteval uint32_t find_keyword_seed()
+{
+    for (uint32_t seed = 1; seed < 1024; seed++) {
+        std::array<bool, keyword_table_size> used {};
+        bool perfect = true;
+        for (const Keyword& keyword : keywords) {
+            size_t slot = keyword_hash(keyword.text, seed);
+            perfect = perfect && !used[slot];
+            used[slot] = true;
+        }
+        if (perfect) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+inline constexpr uint32_t keyword_seed = find_keyword_seed();
+static_assert(keyword_seed != 0, "no perfect hash seed for the keyword set");
+
+constexpr std::array<int8_t, keyword_table_size> make_keyword_table()
+{
+    std::array<int8_t, keyword_table_size> table {};
+    table.fill(-1);
+    for (size_t i = 0; i < keywords.size(); i++) {
+        table[keyword_hash(keywords[i].text, keyword_seed)] = static_cast<int8_t>(i);
+    }
+    return table;
+}
+
+inline constexpr std::array<int8_t, keyword_table_size> keyword_table = make_keyword_table();
+
+// One slot lookup plus a single comparison against the only keyword that can live in that slot. Returns
+// the keyword's index in `keywords`, or -1.
+constexpr int keyword_index(std::string_view word)
+{
+    int8_t index = keyword_table[keyword_hash(word, keyword_seed)];
+    if (index < 0 || keywords[index].text != word) {
+        return -1;
+    }
+    return index;
+}
+
+static_assert(keyword_index("let") == 1 && keyword_index("lets") == -1 && keyword_index("x") == -1);
+
+constexpr const Keyword* find_keyword(std::string_view word)
+{
+    int index = keyword_index(word);
+    return index < 0 ? nullptr : &keywords[index];
+}
+
 class Tokenizer {
 public:
-    inline explicit Tokenizer(std::string src)
-        : m_str(std::move(src))
+    inline explicit Tokenizer(std::string_view src)
+        : Tokenizer(src, 0, src.size())
     {
     }
 
     inline std::vector<Token> tokenize()
     {
         std::vector<Token> tokens;
-        std::string buf;
-        while (peek().has_value()) {
-            if (std::isalpha(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && isalnum(peek().value())) {
-                    buf.push_back(consume());
-                }
-                if (buf == "exit") {
-                    tokens.push_back({ .type = TokenType::exit });
-                    buf.clear();
-                }
-                else if (buf == "let") {
-                    tokens.push_back({ .type = TokenType::let });
-                    buf.clear();
+        while (auto token = next()) {
+            tokens.push_back(token.value());
+        }
+        m_index = m_begin;
+        return tokens;
+    }
+
+    // Throws the error tokenize_parallel() stopped at, if it hit one.
+    inline void rethrow_error() const
+    {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+    // The source text of an identifier token.
+    [[nodiscard]] inline std::string_view text(const Token& token) const
+    {
+        return m_str.substr(token.payload, token.length);
+    }
+
+    // The value of an integer literal token.
+    [[nodiscard]] inline uint64_t literal(const Token& token) const
+    {
+        return m_literals[token.payload];
+    }
+
+    // Same tokens as tokenize(), lexed concurrently on `pool`. The grammar has no token that spans a
+    // newline (comments end at one and there are no string literals), so the source splits at line
+    // boundaries into chunks that are lexed independently and then copied into one stream in order.
+    // Lexing ends at the first error in source order. The tokens before it are returned and the error is
+    // kept for rethrow_error(), so a parser that runs out of tokens reports the same first error as one
+    // pulling them from next(). Waits for the pool, so it must not be called from one of its tasks.
+    [[nodiscard]] inline std::vector<Token> tokenize_parallel(ThreadPool& pool)
+    {
+        std::string_view src = m_str;
+        // A few chunks per thread so a chunk that happens to be token dense doesn't hold up the rest.
+        size_t chunk_count = std::min(pool.size() * 4, std::max<size_t>(src.size() / s_min_chunk, 1));
+        std::vector<size_t> bounds { 0 };
+        for (size_t i = 1; i < chunk_count; i++) {
+            size_t target = std::max(src.size() * i / chunk_count, bounds.back());
+            size_t newline = src.find('\n', target);
+            if (newline == std::string_view::npos) {
+                break;
+            }
+            if (newline + 1 > bounds.back()) {
+                bounds.push_back(newline + 1);
+            }
+        }
+        bounds.push_back(src.size());
+
+        // Chunk tokenizers work on the whole source, so identifier offsets need no fixing up.
+        std::vector<Tokenizer> lexers;
+        for (size_t i = 0; i + 1 < bounds.size(); i++) {
+            lexers.push_back(Tokenizer(src, bounds[i], bounds[i + 1]));
+        }
+        std::vector<std::vector<Token>> chunks(lexers.size());
+        std::vector<std::exception_ptr> errors(lexers.size());
+        for (size_t i = 0; i < chunks.size(); i++) {
+            pool.submit([&, i] {
+                try {
+                    // Token by token, so that whatever precedes an error is kept.
+                    while (auto token = lexers[i].next()) {
+                        chunks[i].push_back(token.value());
+                    }
                 }
-                else if (buf == "if") {
-                    tokens.push_back({ .type = TokenType::_if });
-                    buf.clear();
+                catch (const CompileError&) {
+                    errors[i] = std::current_exception();
                 }
-                else if (buf == "true") {
-                    tokens.push_back({ .type = TokenType::int_lit, .value = "1" });
-                    buf.clear();
+            });
+        }
+        pool.wait();
+        for (size_t i = 0; i < errors.size(); i++) {
+            if (errors[i]) {
+                m_error = errors[i];
+                chunks.resize(i + 1);
+                break;
+            }
+        }
+
+        // Every chunk's literals after `false` and `true` are appended to this tokenizer's table.
+        std::vector<size_t> offsets(chunks.size() + 1, 0);
+        std::vector<uint32_t> literal_bases(chunks.size(), 0);
+        m_literals.resize(2);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            offsets[i + 1] = offsets[i] + chunks[i].size();
+            literal_bases[i] = static_cast<uint32_t>(m_literals.size() - 2);
+            m_literals.insert(m_literals.end(), lexers[i].m_literals.begin() + 2, lexers[i].m_literals.end());
+        }
+        std::vector<Token> tokens(offsets.back());
+        for (size_t i = 0; i < chunks.size(); i++) {
+            pool.submit([&, i] {
+                Token* out = tokens.data() + offsets[i];
+                for (Token token : chunks[i]) {
+                    if (token.type == TokenType::int_lit && token.payload > literal_true) {
+                        token.payload += literal_bases[i];
+                    }
+                    *out++ = token;
                 }
-                else if (buf == "false") {
-                    tokens.push_back({ .type = TokenType::int_lit, .value = "0" });
-                    buf.clear();
+            });
+        }
+        pool.wait();
+        return tokens;
+    }
+
+    // Lexes a single token, or returns nothing at the end of the source.
+    inline std::optional<Token> next()
+    {
+        while (m_index < m_end) {
+            size_t start = m_index;
+            auto c = static_cast<uint8_t>(m_str[m_index]);
+            switch (char_classes[c]) {
+            case CharClass::space:
+                advance(CharClass::space, m_scan->skip_whitespace);
+                continue;
+            case CharClass::alpha: {
+                advance(CharClass::alpha, m_scan->skip_ident);
+                std::string_view word = m_str.substr(start, m_index - start);
+                if (const Keyword* keyword = find_keyword(word)) {
+                    return keyword->token;
                 }
-                else {
-                    tokens.push_back({ .type = TokenType::identifier, .value = buf });
-                    buf.clear();
+                if (word.size() > UINT16_MAX) {
+                    throw CompileError("Identifier too long: " + std::string(word.substr(0, 32)) + "...");
                 }
+                return Token { .type = TokenType::identifier,
+                               .length = static_cast<uint16_t>(word.size()),
+                               .payload = static_cast<uint32_t>(start) };
             }
-            else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({ .type = TokenType::open_parenthesis });
-            }
-            else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({ .type = TokenType::plus });
-            }
-            else if (peek().value() == '<') {
-                if (peek(1).has_value() && peek(1).value() == '=') {
-                    consume();
-                    consume();
-                    tokens.push_back({ .type = TokenType::lte });
-                    continue;
+            case CharClass::digit:
+                advance(CharClass::digit, m_scan->skip_digits);
+                return lex_int_lit(m_str.substr(start, m_index - start));
+            case CharClass::single:
+                m_index++;
+                return Token { .type = op_tokens.single[c] };
+            case CharClass::op_eq:
+                if (m_index + 1 < m_end && m_str[m_index + 1] == '=') {
+                    m_index += 2;
+                    return Token { .type = op_tokens.with_eq[c] };
                 }
-                consume();
-                tokens.push_back({ .type = TokenType::lt });
-            }
-            else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({ .type = TokenType::open_curly });
-            }
-            else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({ .type = TokenType::close_curly });
-            }
-            else if (peek().value() == '>') {
-                if (peek(1).has_value() && peek(1).value() == '=') {
-                    consume();
-                    consume();
-                    tokens.push_back({ .type = TokenType::gte });
-                    continue;
+                if (c == '!') {
+                    break;
                 }
-                consume();
-                tokens.push_back({ .type = TokenType::gt });
-            }
-            else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({ .type = TokenType::star });
-            }
-            else if (peek().value() == '!' && peek(1).has_value() && peek(1).value() == '=') {
-                consume();
-                consume();
-                tokens.push_back({ .type = TokenType::not_equality });
-            }
-            else if (peek().value() == '%') {
-                consume();
-                tokens.push_back({ .type = TokenType::modulo });
-            }
-            else if (peek().value() == '/') {
+                m_index++;
+                return Token { .type = op_tokens.single[c] };
+            case CharClass::slash:
                 // Single Line Comments `//`
-                if (peek(1).has_value() && peek(1).value() == '/') {
-                    consume(); // Consume first slash
-                    consume(); // Consume second slash
-                    while (peek().has_value() && peek().value() != '\n') {
-                        consume();
-                    }
-                    continue;
-                }
-                consume();
-                tokens.push_back({ .type = TokenType::div });
-            }
-            else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({ .type = TokenType::sub });
-            }
-            else if (peek().value() == '=') {
-                if (peek(1).has_value() && peek(1).value() == '=') {
-                    consume();
-                    consume();
-                    tokens.push_back({ .type = TokenType::equality });
+                if (m_index + 1 < m_end && m_str[m_index + 1] == '/') {
+                    const char* begin = m_str.data();
+                    m_index = static_cast<size_t>(m_scan->find_newline(begin + m_index, begin + m_end) - begin);
                     continue;
                 }
-                consume();
-                tokens.push_back({ .type = TokenType::eq });
-            }
-            else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({ .type = TokenType::close_parenthesis });
-            }
-            else if (std::isdigit(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume());
-                }
-                tokens.push_back({ .type = TokenType::int_lit, .value = buf });
-                buf.clear();
-            }
-            else if (peek().value() == ';') {
-                consume();
-                tokens.push_back({ .type = TokenType::semi });
-            }
-            else if (std::isspace(peek().value())) {
-                consume();
-            }
-            else {
-                std::cerr << "You Messed Up.";
-                exit(EXIT_FAILURE);
+                m_index++;
+                return Token { .type = TokenType::div };
+            case CharClass::invalid:
+                break;
             }
+            throw CompileError("You Messed Up.");
         }
-        m_index = 0;
-        return tokens;
+        return {};
     }
 
 private:
-    const std::string m_str;
-    int m_index = 0;
-    [[nodiscard]] inline std::optional<char> peek(int offset = 0) const
+    // Below this many bytes per chunk, handing a chunk to another thread costs more than lexing it.
+    static constexpr size_t s_min_chunk = 64 * 1024;
+
+    // Lexes [begin, end) of `src`, which has to lie on token boundaries.
+    inline Tokenizer(std::string_view src, size_t begin, size_t end)
+        : m_str(src)
+        , m_scan(&scan_kernels())
+        , m_begin(begin)
+        , m_end(end)
+        , m_index(begin)
+    {
+        // Offsets into the source have to fit a token's 32 bit payload.
+        if (src.size() > UINT32_MAX) {
+            throw CompileError("Source file too large");
+        }
+    }
+
+    inline Token lex_int_lit(std::string_view digits)
     {
-        if (m_index + offset >= m_str.length()) {
-            return {};
+        uint64_t value;
+        auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        if (ec != std::errc() || ptr != digits.data() + digits.size()) {
+            throw CompileError("Integer literal out of range: " + std::string(digits));
         }
-        else {
-            return m_str.at(m_index + offset);
+        m_literals.push_back(value);
+        return Token { .type = TokenType::int_lit, .payload = static_cast<uint32_t>(m_literals.size() - 1) };
+    }
+
+    std::string_view m_str;
+    const ScanKernels* m_scan;
+    size_t m_begin;
+    size_t m_end;
+    size_t m_index;
+    std::vector<uint64_t> m_literals { 0, 1 };
+    // The error tokenize_parallel() stopped at, if any.
+    std::exception_ptr m_error;
+
+    // Moves m_index past a run of `cls` characters. Most runs are a single character, so the kernel is
+    // only called when the run continues past its first byte.
+    inline void advance(CharClass cls, const char* (*kernel)(const char*, const char*))
+    {
+        m_index++;
+        if (m_index >= m_end || !continues(cls, char_classes[static_cast<uint8_t>(m_str[m_index])])) {
+            return;
         }
+        const char* begin = m_str.data();
+        m_index = static_cast<size_t>(kernel(begin + m_index, begin + m_end) - begin);
     }
 
-    inline char consume()
+    [[nodiscard]] static inline bool continues(CharClass run, CharClass next)
     {
-        return m_str.at(m_index++);
+        return next == run || (run == CharClass::alpha && next == CharClass::digit);
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "bytecode.hpp"
+
+// Interpreter for BytecodeProgram. Dispatch is threaded through a table of label addresses (a GNU
+// extension that GCC and Clang both support), so every handler ends in its own indirect jump to the next
+// one instead of going back through a shared switch.
+class Vm {
+public:
+    // Runs `program` until it exits and returns the exit value. Dividing by zero raises SIGFPE, just
+    // like the native program would.
+    [[nodiscard]] static uint64_t run(const BytecodeProgram& program)
+    {
+        std::vector<uint64_t> frame(program.frame_size + program.constants.size());
+        std::copy(program.constants.begin(), program.constants.end(), frame.begin() + program.frame_size);
+        uint64_t* regs = frame.data();
+        const BytecodeInstr* code = program.code.data();
+        const BytecodeInstr* pc = code;
+
+        // In BytecodeOp order.
+        static const void* const dispatch[] = {
+            &&add,
+            &&sub,
+            &&mul,
+            &&div,
+            &&mod,
+            &&lt,
+            &&gt,
+            &&lte,
+            &&gte,
+            &&equal,
+            &&not_equal,
+            &&jump_unless_lt,
+            &&jump_unless_gt,
+            &&jump_unless_lte,
+            &&jump_unless_gte,
+            &&jump_unless_equal,
+            &&jump_unless_not_equal,
+            &&jump_if_zero,
+            &&exit,
+        };
+        static_assert(std::size(dispatch) == bytecode_op_count);
+
+        auto sgn = [&](uint32_t reg) { return static_cast<int64_t>(regs[reg]); };
+
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    add:
+        regs[pc->dst] = regs[pc->lhs] + regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    sub:
+        regs[pc->dst] = regs[pc->lhs] - regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    mul:
+        regs[pc->dst] = regs[pc->lhs] * regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    div:
+        check_divisor(regs[pc->rhs]);
+        regs[pc->dst] = regs[pc->lhs] / regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    mod:
+        check_divisor(regs[pc->rhs]);
+        regs[pc->dst] = regs[pc->lhs] % regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    lt:
+        regs[pc->dst] = sgn(pc->lhs) < sgn(pc->rhs);
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    gt:
+        regs[pc->dst] = sgn(pc->lhs) > sgn(pc->rhs);
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    lte:
+        regs[pc->dst] = sgn(pc->lhs) <= sgn(pc->rhs);
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    gte:
+        regs[pc->dst] = sgn(pc->lhs) >= sgn(pc->rhs);
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    equal:
+        regs[pc->dst] = regs[pc->lhs] == regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    not_equal:
+        regs[pc->dst] = regs[pc->lhs] != regs[pc->rhs];
+        pc++;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_lt:
+        pc = sgn(pc->lhs) < sgn(pc->rhs) ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_gt:
+        pc = sgn(pc->lhs) > sgn(pc->rhs) ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_lte:
+        pc = sgn(pc->lhs) <= sgn(pc->rhs) ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_gte:
+        pc = sgn(pc->lhs) >= sgn(pc->rhs) ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_equal:
+        pc = regs[pc->lhs] == regs[pc->rhs] ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_unless_not_equal:
+        pc = regs[pc->lhs] != regs[pc->rhs] ? pc + 1 : code + pc->dst;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    jump_if_zero:
+        pc = regs[pc->lhs] == 0 ? code + pc->dst : pc + 1;
+        goto* dispatch[static_cast<size_t>(pc->op)];
+    exit:
+        return regs[pc->lhs];
+    }
+
+private:
+    static inline void check_divisor(uint64_t divisor)
+    {
+        if (divisor == 0) [[unlikely]] {
+            std::signal(SIGFPE, SIG_DFL);
+            std::raise(SIGFPE);
+        }
+    }
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "instruction.hpp"
+
+// Encodes instructions straight into x86-64 machine code, without going through assembly text.
+// Jumps start out in their two byte rel8 form and are relaxed to rel32 until every displacement fits.
+class X86Encoder {
+public:
+    // The returned code is position independent and starts executing at offset 0.
+    [[nodiscard]] std::vector<uint8_t> encode(const std::vector<Instr>& code)
+    {
+        // Encode everything but the jumps once; their size only depends on the jump form.
+        m_bytes.clear();
+        std::vector<size_t> starts;
+        std::vector<size_t> sizes;
+        std::vector<bool> near;
+        std::vector<size_t> label_instr;
+        starts.reserve(code.size());
+        sizes.reserve(code.size());
+        near.assign(code.size(), false);
+        for (size_t i = 0; i < code.size(); i++) {
+            const Instr& instr = code[i];
+            starts.push_back(m_bytes.size());
+            if (instr.op == Op::label) {
+                if (instr.label >= label_instr.size()) {
+                    label_instr.resize(instr.label + 1, s_undefined);
+                }
+                label_instr[instr.label] = i;
+            }
+            else if (!is_jump(instr.op)) {
+                encode_instr(instr);
+            }
+            sizes.push_back(is_jump(instr.op) ? 2 : m_bytes.size() - starts.back());
+        }
+
+        // Widen jumps whose target is out of rel8 range until nothing changes. Jumps only ever grow, so
+        // this terminates.
+        std::vector<int64_t> offsets(code.size() + 1);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = 0; i < code.size(); i++) {
+                offsets[i + 1] = offsets[i] + static_cast<int64_t>(sizes[i]);
+            }
+            for (size_t i = 0; i < code.size(); i++) {
+                if (!is_jump(code[i].op) || near[i]) {
+                    continue;
+                }
+                int64_t disp = offsets[target(label_instr, code[i].label)] - offsets[i + 1];
+                if (disp < INT8_MIN || disp > INT8_MAX) {
+                    near[i] = true;
+                    sizes[i] = code[i].op == Op::jcc ? 6 : 5;
+                    changed = true;
+                }
+            }
+        }
+
+        std::vector<uint8_t> out;
+        out.reserve(static_cast<size_t>(offsets.back()));
+        for (size_t i = 0; i < code.size(); i++) {
+            const Instr& instr = code[i];
+            if (!is_jump(instr.op)) {
+                out.insert(out.end(), m_bytes.begin() + starts[i], m_bytes.begin() + starts[i] + sizes[i]);
+                continue;
+            }
+            int64_t disp = offsets[target(label_instr, instr.label)] - offsets[i + 1];
+            auto cc = static_cast<uint8_t>(instr.cond);
+            if (!near[i]) {
+                out.push_back(instr.op == Op::jcc ? 0x70 | cc : 0xEB);
+                out.push_back(static_cast<uint8_t>(disp));
+                continue;
+            }
+            if (instr.op == Op::jcc) {
+                out.push_back(0x0F);
+                out.push_back(0x80 | cc);
+            }
+            else {
+                out.push_back(0xE9);
+            }
+            append_le(out, static_cast<uint32_t>(disp), 4);
+        }
+        return out;
+    }
+
+private:
+    static constexpr size_t s_undefined = SIZE_MAX;
+
+    static inline bool is_jump(Op op)
+    {
+        return op == Op::jcc || op == Op::jmp;
+    }
+
+    static size_t target(const std::vector<size_t>& label_instr, uint32_t label)
+    {
+        if (label >= label_instr.size() || label_instr[label] == s_undefined) {
+            std::cerr << "Undefined label: label" << label << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return label_instr[label];
+    }
+
+    static inline void append_le(std::vector<uint8_t>& out, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    static inline uint8_t low(Reg reg)
+    {
+        return static_cast<uint8_t>(reg) & 7;
+    }
+
+    static inline bool ext(Reg reg)
+    {
+        return static_cast<uint8_t>(reg) >= 8;
+    }
+
+    // REX prefix for an instruction with `reg` in the ModRM reg field and `rm` as the r/m operand.
+    void rex(bool wide, bool reg_ext, const Operand& rm)
+    {
+        bool base_ext = rm.kind != OperandKind::none && ext(rm.reg);
+        bool index_ext = rm.kind == OperandKind::mem && rm.scale != 0 && ext(rm.index);
+        if (wide || reg_ext || index_ext || base_ext) {
+            m_bytes.push_back(0x40 | (wide ? 8 : 0) | (reg_ext ? 4 : 0) | (index_ext ? 2 : 0) | (base_ext ? 1 : 0));
+        }
+    }
+
+    void modrm(uint8_t reg, const Operand& rm)
+    {
+        if (rm.kind == OperandKind::reg) {
+            m_bytes.push_back(0xC0 | (reg << 3) | low(rm.reg));
+            return;
+        }
+        auto disp = static_cast<int32_t>(rm.value);
+        // rbp and r13 have no disp-less form, rsp and r12 always need a SIB byte.
+        uint8_t mod = (disp == 0 && low(rm.reg) != 5) ? 0 : (disp >= INT8_MIN && disp <= INT8_MAX) ? 1 : 2;
+        if (rm.scale != 0) {
+            uint8_t scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            m_bytes.push_back((mod << 6) | (reg << 3) | 4);
+            m_bytes.push_back((scale_bits << 6) | (low(rm.index) << 3) | low(rm.reg));
+        }
+        else {
+            m_bytes.push_back((mod << 6) | (reg << 3) | low(rm.reg));
+            if (low(rm.reg) == 4) {
+                m_bytes.push_back(0x24);
+            }
+        }
+        if (mod == 1) {
+            m_bytes.push_back(static_cast<uint8_t>(disp));
+        }
+        else if (mod == 2) {
+            append_le(m_bytes, static_cast<uint32_t>(disp), 4);
+        }
+    }
+
+    // `opcode reg, r/m` with a 64 bit operand size.
+    void op_reg_rm(std::initializer_list<uint8_t> opcode, Reg reg, const Operand& rm)
+    {
+        rex(true, ext(reg), rm);
+        m_bytes.insert(m_bytes.end(), opcode);
+        modrm(low(reg), rm);
+    }
+
+    // `opcode /digit r/m` with a 64 bit operand size.
+    void op_digit_rm(uint8_t opcode, uint8_t digit, const Operand& rm)
+    {
+        rex(true, false, rm);
+        m_bytes.push_back(opcode);
+        modrm(digit, rm);
+    }
+
+    // add, sub, cmp, and and xor share their encodings apart from the opcode and the /digit.
+    void arith(const Instr& instr, uint8_t reg_opcode, uint8_t digit)
+    {
+        if (instr.src.kind == OperandKind::imm) {
+            if (instr.src.value >= INT8_MIN && instr.src.value <= INT8_MAX) {
+                op_digit_rm(0x83, digit, instr.dst);
+                m_bytes.push_back(static_cast<uint8_t>(instr.src.value));
+            }
+            else {
+                op_digit_rm(0x81, digit, instr.dst);
+                append_le(m_bytes, static_cast<uint32_t>(instr.src.value), 4);
+            }
+            return;
+        }
+        op_reg_rm({ reg_opcode }, instr.src.reg, instr.dst);
+    }
+
+    void mov(const Instr& instr)
+    {
+        if (instr.src.kind == OperandKind::reg) {
+            op_reg_rm({ 0x89 }, instr.src.reg, instr.dst);
+        }
+        else if (instr.src.kind == OperandKind::mem) {
+            op_reg_rm({ 0x8B }, instr.dst.reg, instr.src);
+        }
+        else if (instr.src.value >= 0 && instr.src.value <= UINT32_MAX) {
+            // Writing the 32 bit register zero extends into the full register.
+            rex(false, false, instr.dst);
+            m_bytes.push_back(0xB8 + low(instr.dst.reg));
+            append_le(m_bytes, static_cast<uint64_t>(instr.src.value), 4);
+        }
+        else if (instr.src.value >= INT32_MIN && instr.src.value <= INT32_MAX) {
+            op_digit_rm(0xC7, 0, instr.dst);
+            append_le(m_bytes, static_cast<uint64_t>(instr.src.value), 4);
+        }
+        else {
+            rex(true, false, instr.dst);
+            m_bytes.push_back(0xB8 + low(instr.dst.reg));
+            append_le(m_bytes, static_cast<uint64_t>(instr.src.value), 8);
+        }
+    }
+
+    // shl and shr by an immediate count.
+    void shift(const Instr& instr, uint8_t digit)
+    {
+        if (instr.src.value == 1) {
+            op_digit_rm(0xD1, digit, instr.dst);
+            return;
+        }
+        op_digit_rm(0xC1, digit, instr.dst);
+        m_bytes.push_back(static_cast<uint8_t>(instr.src.value));
+    }
+
+    void imul(const Instr& instr)
+    {
+        if (instr.src.kind != OperandKind::imm) {
+            op_reg_rm({ 0x0F, 0xAF }, instr.dst.reg, instr.src);
+        }
+        else if (instr.src.value >= INT8_MIN && instr.src.value <= INT8_MAX) {
+            op_reg_rm({ 0x6B }, instr.dst.reg, instr.dst);
+            m_bytes.push_back(static_cast<uint8_t>(instr.src.value));
+        }
+        else {
+            op_reg_rm({ 0x69 }, instr.dst.reg, instr.dst);
+            append_le(m_bytes, static_cast<uint32_t>(instr.src.value), 4);
+        }
+    }
+
+    void encode_instr(const Instr& instr)
+    {
+        switch (instr.op) {
+        case Op::mov:
+            mov(instr);
+            break;
+        case Op::push:
+            if (instr.dst.kind == OperandKind::mem) {
+                rex(false, false, instr.dst);
+                m_bytes.push_back(0xFF);
+                modrm(6, instr.dst);
+            }
+            else {
+                rex(false, false, instr.dst);
+                m_bytes.push_back(0x50 + low(instr.dst.reg));
+            }
+            break;
+        case Op::pop:
+            rex(false, false, instr.dst);
+            m_bytes.push_back(0x58 + low(instr.dst.reg));
+            break;
+        case Op::add:
+            arith(instr, 0x01, 0);
+            break;
+        case Op::sub:
+            arith(instr, 0x29, 5);
+            break;
+        case Op::cmp:
+            arith(instr, 0x39, 7);
+            break;
+        case Op::mul:
+            op_digit_rm(0xF7, 4, instr.dst);
+            break;
+        case Op::div:
+            op_digit_rm(0xF7, 6, instr.dst);
+            break;
+        case Op::cmov:
+            op_reg_rm({ 0x0F, static_cast<uint8_t>(0x40 | static_cast<uint8_t>(instr.cond)) }, instr.dst.reg, instr.src);
+            break;
+        case Op::test:
+            op_reg_rm({ 0x85 }, instr.src.reg, instr.dst);
+            break;
+        case Op::_xor:
+            if (instr.dst.kind == OperandKind::reg && instr.src.is_reg(instr.dst.reg)) {
+                // Zeroing idiom; the 32 bit form is shorter and clears the upper half as well.
+                rex(false, ext(instr.dst.reg), instr.dst);
+                m_bytes.push_back(0x31);
+                modrm(low(instr.dst.reg), instr.dst);
+            }
+            else {
+                arith(instr, 0x31, 6);
+            }
+            break;
+        case Op::_and:
+            arith(instr, 0x21, 4);
+            break;
+        case Op::shl:
+            shift(instr, 4);
+            break;
+        case Op::shr:
+            shift(instr, 5);
+            break;
+        case Op::imul:
+            imul(instr);
+            break;
+        case Op::lea:
+            op_reg_rm({ 0x8D }, instr.dst.reg, instr.src);
+            break;
+        case Op::syscall:
+            m_bytes.push_back(0x0F);
+            m_bytes.push_back(0x05);
+            break;
+        case Op::jcc:
+        case Op::jmp:
+        case Op::label:
+            break;
+        }
+    }
+
+    std::vector<uint8_t> m_bytes {};
+};